@@ -17,20 +17,60 @@
  * Boston, MA 02111-1307, USA.
  */
 
+#include <stdlib.h>
+#include <string.h>
+#include <gst/rtsp/gstrtspconnection.h>
+#include <gst/sdp/gstsdpmessage.h>
+#include <gst/rtp/gstrtpbuffer.h>
+
 #include "gst-rtsp-relay-media-factory.h"
 
 #define DEFAULT_LOCATION NULL
+#define DEFAULT_STANDBY_LOCATION NULL
+#define DEFAULT_FAILOVER_TIMEOUT 100 * GST_MSECOND
+/* how long an upstream that never delivered is given to start, counted from
+ * the first packet of either upstream */
+#define FAILOVER_STARTUP_GRACE 5 * GST_SECOND
 #define DEFAULT_FIND_DYNAMIC_STREAMS TRUE
+#define DEFAULT_SDP_PROBE FALSE
 #define DEFAULT_TIMEOUT 60 * GST_SECOND
 #define DEFAULT_LATENCY 2 * GST_SECOND
+#define DEFAULT_UDP_BUFFER_SIZE 0x200000
+#define DEFAULT_MAX_VARIANTS 1
+#define DEFAULT_MAX_CLIENTS 0
+#define DEFAULT_MAX_BANDWIDTH 0
+#define DEFAULT_BITRATE_ESTIMATE 2000000
+/* how long an admitted client counts against the limits before playing */
+#define ADMISSION_TIMEOUT 10 * GST_SECOND
+#define DEFAULT_PREWARM_PAYLOADERS 0
+#define PAYLOADER_POOL_MAX 32
 
 enum
 {
   PROP_0,
   PROP_LOCATION,
+  PROP_STANDBY_LOCATION,
+  PROP_FAILOVER_TIMEOUT,
   PROP_FIND_DYNAMIC_STREAMS,
+  PROP_SDP_PROBE,
   PROP_TIMEOUT,
   PROP_LATENCY,
+  PROP_UDP_BUFFER_SIZE,
+  PROP_MAX_VARIANTS,
+  PROP_PREWARM_PAYLOADERS,
+  PROP_MAX_CLIENTS,
+  PROP_MAX_BANDWIDTH,
+  PROP_BITRATE_ESTIMATE,
+  PROP_CLIENTS,
+  PROP_BANDWIDTH,
+  PROP_TASK_POOL,
+  PROP_MEDIAS,
+  PROP_OBJECTS,
+  PROP_OBJECT_BYTES,
+  PROP_PACKETS_RECEIVED,
+  PROP_PACKETS_LOST,
+  PROP_STANDBY_PACKETS_RECEIVED,
+  PROP_STANDBY_PACKETS_LOST,
 };
 
 enum
@@ -42,8 +82,27 @@ typedef struct
 {
   GstCaps *caps;
   GstElement *payloader;
+  /* switches the payloader between the primary and standby upstream, NULL
+   * without a standby upstream */
+  GstElement *selector;
 } DynamicPayloader;
 
+typedef struct
+{
+  /* owned by the media bin, like the pads */
+  GstElement *selector;
+  GstPad *primary;
+  GstPad *standby;
+  /* the standby pad linking to the selector must match these */
+  GstCaps *caps;
+  /* protected by the selector object lock */
+  GstClockTime first_packet;
+  GstClockTime last_primary;
+  GstClockTime last_standby;
+  gboolean on_standby;
+  GstClockTime timeout;
+} FailoverState;
+
 GST_DEBUG_CATEGORY_STATIC (rtsp_relay_media_factory_debug);
 #define GST_CAT_DEFAULT rtsp_relay_media_factory_debug
 
@@ -56,6 +115,14 @@ static GstElement * gst_rtsp_relay_media_factory_get_element (GstRTSPMediaFactor
     const GstRTSPUrl *url);
 static void gst_rtsp_relay_media_factory_configure (GstRTSPMediaFactory * factory,
     GstRTSPMedia * media);
+static gchar * gst_rtsp_relay_media_factory_gen_key (GstRTSPMediaFactory *factory,
+    const GstRTSPUrl *url);
+static GstRTSPMedia * gst_rtsp_relay_media_factory_construct (GstRTSPMediaFactory *factory,
+    const GstRTSPUrl *url);
+static void update_factory_usage_unlocked (GstRTSPRelayMediaFactory *factory);
+static void track_element (GstRTSPRelayMediaFactory *factory, GstElement *element);
+static void payloader_queue_free (GQueue *queue);
+static void prewarm_payloaders (GstRTSPRelayMediaFactory *factory);
 static void rtspsrc_pad_blocked_cb_link_dynamic (GstPad *pad, gboolean blocked,
     gpointer user_data);
 
@@ -77,22 +144,82 @@ typedef struct
 {
   GstStaticCaps *caps;
   const gchar *description;
+  /* used for thinned variants, the depayloader must be named depay and
+   * output whole frames. NULL if the stream is relayed as is. */
+  const gchar *thin_description;
 } PayloaderBin;
 
 static PayloaderBin payloader_bins[] = {
-  { &rtp_h264_video_caps, "rtph264depay ! rtph264pay pt=96" },
-  { &rtp_mpeg4_generic_audio_caps, "rtpmp4gdepay ! rtpmp4gpay pt=97" },
-  { &rtp_mp3_audio_caps, "rtpmpadepay ! mpegaudioparse ! rtpmpapay pt=97" },
-  { NULL, NULL }
+  { &rtp_h264_video_caps, "rtph264depay ! rtph264pay pt=96",
+    "rtph264depay name=depay access-unit=true ! "
+    "rtph264pay pt=96 config-interval=1" },
+  { &rtp_mpeg4_generic_audio_caps, "rtpmp4gdepay ! rtpmp4gpay pt=97", NULL },
+  { &rtp_mp3_audio_caps, "rtpmpadepay ! mpegaudioparse ! rtpmpapay pt=97", NULL },
+  { NULL, NULL, NULL }
 };
 
+typedef struct
+{
+  GstRTSPRelayVariant variant;
+  guint interval;
+  guint keyframes;
+  gboolean passing;
+} ThinState;
+
+typedef struct
+{
+  /* bytes sent by the payloaders since last_sample, protected by lock */
+  GStaticMutex lock;
+  guint64 bytes;
+  GstClockTime last_sample;
+  guint64 bitrate;
+  /* FALSE until bitrate has been measured over a full interval */
+  gboolean sampled;
+} MediaStats;
+
+/* protects the registered factories and their usage samples */
+static GStaticMutex usage_lock = G_STATIC_MUTEX_INIT;
+static GList *factories = NULL;
+static guint global_max_clients = 0;
+static guint64 global_max_bandwidth = 0;
+
+/* whether gen_key admitted the client of the current request */
+static GStaticPrivate client_admitted = G_STATIC_PRIVATE_INIT;
+
+/* whether gen_key let the variant asked for by the current request in,
+ * construct and get_element run right after it in the same thread */
+static GStaticPrivate variant_admitted = G_STATIC_PRIVATE_INIT;
+
+/* looked up once instead of for every media */
+static GstElementFactory *rtspsrc_factory = NULL;
+
+static MediaStats *
+media_stats_new (void)
+{
+  MediaStats *stats;
+
+  stats = g_new0 (MediaStats, 1);
+  g_static_mutex_init (&stats->lock);
+
+  return stats;
+}
+
+static void
+media_stats_free (MediaStats *stats)
+{
+  g_static_mutex_free (&stats->lock);
+  g_free (stats);
+}
+
 static DynamicPayloader *
 dynamic_payloader_new (GstElement *payloader, GstCaps *caps)
 {
   DynamicPayloader *dynamic_payloader;
 
+  /* takes ownership of the payloader reference and of caps, so that freeing
+   * the entry disposes payloaders that never made it into a bin */
   dynamic_payloader = g_new0 (DynamicPayloader, 1);
-  dynamic_payloader->payloader = gst_object_ref (payloader);
+  dynamic_payloader->payloader = payloader;
   dynamic_payloader->caps = caps;
 
   return dynamic_payloader;
@@ -103,9 +230,32 @@ dynamic_payloader_free (DynamicPayloader *dynamic_payloader)
 {
   gst_caps_unref (dynamic_payloader->caps);
   gst_object_unref (dynamic_payloader->payloader);
+  if (dynamic_payloader->selector)
+    gst_object_unref (dynamic_payloader->selector);
   g_free (dynamic_payloader);
 }
 
+static void
+dynamic_payloaders_free (GQueue *dynamic_payloaders)
+{
+  g_queue_foreach (dynamic_payloaders, (GFunc) dynamic_payloader_free, NULL);
+  g_queue_free (dynamic_payloaders);
+}
+
+static void
+failover_state_free (FailoverState *state)
+{
+  gst_caps_unref (state->caps);
+  g_free (state);
+}
+
+static void
+failover_states_free (GPtrArray *states)
+{
+  g_ptr_array_foreach (states, (GFunc) failover_state_free, NULL);
+  g_ptr_array_free (states, TRUE);
+}
+
 static void
 gst_rtsp_relay_media_factory_class_init (GstRTSPRelayMediaFactoryClass * klass)
 {
@@ -120,16 +270,37 @@ gst_rtsp_relay_media_factory_class_init (GstRTSPRelayMediaFactoryClass * klass)
 
   media_factory_class->get_element = gst_rtsp_relay_media_factory_get_element;
   media_factory_class->configure = gst_rtsp_relay_media_factory_configure;
+  media_factory_class->gen_key = gst_rtsp_relay_media_factory_gen_key;
+  media_factory_class->construct = gst_rtsp_relay_media_factory_construct;
 
   g_object_class_install_property (gobject_class, PROP_LOCATION,
       g_param_spec_string ("location", "Location", "Location",
           DEFAULT_LOCATION, G_PARAM_READWRITE | G_PARAM_CONSTRUCT));
 
+  g_object_class_install_property (gobject_class, PROP_STANDBY_LOCATION,
+      g_param_spec_string ("standby-location", "Standby location",
+          "location of an upstream publishing the same streams, kept playing "
+          "and switched to when location stalls",
+          DEFAULT_STANDBY_LOCATION, G_PARAM_READWRITE | G_PARAM_CONSTRUCT));
+
+  g_object_class_install_property (gobject_class, PROP_FAILOVER_TIMEOUT,
+      g_param_spec_uint64 ("failover-timeout",
+          "Failover timeout", "time without packets after which an upstream "
+          "is considered stalled",
+          1, G_MAXUINT64, DEFAULT_FAILOVER_TIMEOUT, G_PARAM_READWRITE | G_PARAM_CONSTRUCT));
+
   g_object_class_install_property (gobject_class, PROP_FIND_DYNAMIC_STREAMS,
       g_param_spec_boolean ("find-dynamic-streams",
           "Find dynamic streams", "find dynamic streams",
           DEFAULT_FIND_DYNAMIC_STREAMS, G_PARAM_READWRITE | G_PARAM_CONSTRUCT_ONLY));
 
+  g_object_class_install_property (gobject_class, PROP_SDP_PROBE,
+      g_param_spec_boolean ("sdp-probe",
+          "SDP probe", "find streams with a DESCRIBE request instead of "
+          "playing the upstream, falling back to playing it if the SDP "
+          "can't be mapped to payloaders",
+          DEFAULT_SDP_PROBE, G_PARAM_READWRITE | G_PARAM_CONSTRUCT));
+
   g_object_class_install_property (gobject_class, PROP_TIMEOUT,
       g_param_spec_uint64 ("timeout",
           "Timeout", "timeout",
@@ -140,8 +311,103 @@ gst_rtsp_relay_media_factory_class_init (GstRTSPRelayMediaFactoryClass * klass)
           "Latency", "latency",
           0, G_MAXUINT64, DEFAULT_LATENCY, G_PARAM_READWRITE | G_PARAM_CONSTRUCT));
 
+  g_object_class_install_property (gobject_class, PROP_UDP_BUFFER_SIZE,
+      g_param_spec_int ("udp-buffer-size",
+          "UDP buffer size", "kernel receive buffer size of the upstream "
+          "UDP sockets, capped by net.core.rmem_max",
+          0, G_MAXINT, DEFAULT_UDP_BUFFER_SIZE, G_PARAM_READWRITE | G_PARAM_CONSTRUCT));
+
+  g_object_class_install_property (gobject_class, PROP_MAX_VARIANTS,
+      g_param_spec_uint ("max-variants",
+          "Max variants", "maximum number of thinned variants relayed at the "
+          "same time. Every variant pulls the upstream once more, clients "
+          "asking for more variants get the full stream",
+          0, G_MAXUINT, DEFAULT_MAX_VARIANTS, G_PARAM_READWRITE | G_PARAM_CONSTRUCT));
+
+  g_object_class_install_property (gobject_class, PROP_PREWARM_PAYLOADERS,
+      g_param_spec_uint ("prewarm-payloaders",
+          "Prewarm payloaders", "number of payloader bins built ahead for "
+          "each codec, so that new medias don't wait for them",
+          0, PAYLOADER_POOL_MAX, DEFAULT_PREWARM_PAYLOADERS,
+          G_PARAM_READWRITE | G_PARAM_CONSTRUCT));
+
+  g_object_class_install_property (gobject_class, PROP_MAX_CLIENTS,
+      g_param_spec_uint ("max-clients",
+          "Max clients", "maximum number of playing clients, 0 for unlimited",
+          0, G_MAXUINT, DEFAULT_MAX_CLIENTS, G_PARAM_READWRITE | G_PARAM_CONSTRUCT));
+
+  g_object_class_install_property (gobject_class, PROP_MAX_BANDWIDTH,
+      g_param_spec_uint64 ("max-bandwidth",
+          "Max bandwidth", "maximum estimated egress in bits per second, "
+          "0 for unlimited",
+          0, G_MAXUINT64, DEFAULT_MAX_BANDWIDTH, G_PARAM_READWRITE | G_PARAM_CONSTRUCT));
+
+  g_object_class_install_property (gobject_class, PROP_BITRATE_ESTIMATE,
+      g_param_spec_uint64 ("bitrate-estimate",
+          "Bitrate estimate", "bitrate in bits per second assumed for a "
+          "media that hasn't been measured yet",
+          0, G_MAXUINT64, DEFAULT_BITRATE_ESTIMATE, G_PARAM_READWRITE | G_PARAM_CONSTRUCT));
+
+  g_object_class_install_property (gobject_class, PROP_CLIENTS,
+      g_param_spec_uint ("clients",
+          "Clients", "number of playing clients and of admitted clients "
+          "that aren't playing yet",
+          0, G_MAXUINT, 0, G_PARAM_READABLE));
+
+  g_object_class_install_property (gobject_class, PROP_BANDWIDTH,
+      g_param_spec_uint64 ("bandwidth",
+          "Bandwidth", "estimated egress in bits per second",
+          0, G_MAXUINT64, 0, G_PARAM_READABLE));
+
+  g_object_class_install_property (gobject_class, PROP_TASK_POOL,
+      g_param_spec_object ("task-pool",
+          "Task pool", "prepared task pool running the streaming threads "
+          "of the medias, NULL for the default pool",
+          GST_TYPE_TASK_POOL, G_PARAM_READWRITE));
+
+  g_object_class_install_property (gobject_class, PROP_MEDIAS,
+      g_param_spec_int ("medias",
+          "Medias", "number of live medias",
+          0, G_MAXINT, 0, G_PARAM_READABLE));
+
+  g_object_class_install_property (gobject_class, PROP_OBJECTS,
+      g_param_spec_int ("objects",
+          "Objects", "number of live elements created for the medias",
+          0, G_MAXINT, 0, G_PARAM_READABLE));
+
+  g_object_class_install_property (gobject_class, PROP_OBJECT_BYTES,
+      g_param_spec_int ("object-bytes",
+          "Object bytes", "instance size of the live elements created for "
+          "the medias, not counting buffers and other allocations",
+          0, G_MAXINT, 0, G_PARAM_READABLE));
+
+  g_object_class_install_property (gobject_class, PROP_PACKETS_RECEIVED,
+      g_param_spec_uint64 ("packets-received",
+          "Packets received", "RTP packets received from location",
+          0, G_MAXUINT64, 0, G_PARAM_READABLE));
+
+  g_object_class_install_property (gobject_class, PROP_PACKETS_LOST,
+      g_param_spec_uint64 ("packets-lost",
+          "Packets lost", "RTP packets from location that were never "
+          "received",
+          0, G_MAXUINT64, 0, G_PARAM_READABLE));
+
+  g_object_class_install_property (gobject_class, PROP_STANDBY_PACKETS_RECEIVED,
+      g_param_spec_uint64 ("standby-packets-received",
+          "Standby packets received", "RTP packets received from "
+          "standby-location",
+          0, G_MAXUINT64, 0, G_PARAM_READABLE));
+
+  g_object_class_install_property (gobject_class, PROP_STANDBY_PACKETS_LOST,
+      g_param_spec_uint64 ("standby-packets-lost",
+          "Standby packets lost", "RTP packets from standby-location that "
+          "were never received",
+          0, G_MAXUINT64, 0, G_PARAM_READABLE));
+
   GST_DEBUG_CATEGORY_INIT (rtsp_relay_media_factory_debug,
       "rtsprelaymediafactory", 0, "RTSP Relay Media Factory");
+
+  rtspsrc_factory = gst_element_factory_find ("rtspsrc");
 }
 
 static void
@@ -149,13 +415,43 @@ gst_rtsp_relay_media_factory_init (GstRTSPRelayMediaFactory * factory)
 {
   factory->lock = g_mutex_new ();
   factory->location = NULL;
+  factory->sdp_probe = DEFAULT_SDP_PROBE;
   factory->rtspsrc_no_more_pads = FALSE;
   factory->dynamic_pads_cond = g_cond_new ();
   factory->pads_waiting_block = 0;
   factory->dynamic_payloaders = NULL;
+  factory->standby_location = NULL;
+  factory->failover_timeout = DEFAULT_FAILOVER_TIMEOUT;
   factory->timeout = DEFAULT_TIMEOUT;
   factory->latency = DEFAULT_LATENCY;
+  factory->udp_buffer_size = DEFAULT_UDP_BUFFER_SIZE;
   factory->error = FALSE;
+  factory->variant = GST_RTSP_RELAY_VARIANT_FULL;
+  factory->variant_interval = 1;
+  factory->max_variants = DEFAULT_MAX_VARIANTS;
+  factory->payloader_pool_lock = g_mutex_new ();
+  factory->payloader_pool = g_hash_table_new_full (g_str_hash, g_str_equal,
+      g_free, (GDestroyNotify) payloader_queue_free);
+  factory->prewarm_payloaders = DEFAULT_PREWARM_PAYLOADERS;
+  factory->max_clients = DEFAULT_MAX_CLIENTS;
+  factory->max_bandwidth = DEFAULT_MAX_BANDWIDTH;
+  factory->bitrate_estimate = DEFAULT_BITRATE_ESTIMATE;
+  factory->clients = 0;
+  factory->bandwidth = 0;
+  factory->media_bitrate = DEFAULT_BITRATE_ESTIMATE;
+  factory->pending = g_array_new (FALSE, FALSE, sizeof (GstClockTime));
+  factory->playing = 0;
+  factory->task_pool = NULL;
+  factory->medias = 0;
+  factory->objects = 0;
+  factory->object_bytes = 0;
+  factory->packets_lock = g_mutex_new ();
+  memset (factory->packets_received, 0, sizeof (factory->packets_received));
+  memset (factory->packets_lost, 0, sizeof (factory->packets_lost));
+
+  g_static_mutex_lock (&usage_lock);
+  factories = g_list_prepend (factories, factory);
+  g_static_mutex_unlock (&usage_lock);
 }
 
 static void
@@ -163,8 +459,19 @@ gst_rtsp_relay_media_factory_finalize (GObject * obj)
 {
   GstRTSPRelayMediaFactory *factory = GST_RTSP_RELAY_MEDIA_FACTORY (obj);
 
+  g_static_mutex_lock (&usage_lock);
+  factories = g_list_remove (factories, factory);
+  g_static_mutex_unlock (&usage_lock);
+
   g_free (factory->location);
+  g_free (factory->standby_location);
+  g_array_free (factory->pending, TRUE);
+  if (factory->task_pool)
+    gst_object_unref (factory->task_pool);
   g_mutex_free (factory->lock);
+  g_mutex_free (factory->packets_lock);
+  g_hash_table_destroy (factory->payloader_pool);
+  g_mutex_free (factory->payloader_pool_lock);
   g_cond_free (factory->dynamic_pads_cond);
   g_list_foreach (factory->dynamic_payloaders, (GFunc) dynamic_payloader_free, NULL);
   g_list_free (factory->dynamic_payloaders);
@@ -182,15 +489,80 @@ gst_rtsp_relay_media_factory_get_property (GObject *object, guint propid,
     case PROP_LOCATION:
       g_value_set_string (value, factory->location);
       break;
+    case PROP_STANDBY_LOCATION:
+      g_value_set_string (value, factory->standby_location);
+      break;
+    case PROP_FAILOVER_TIMEOUT:
+      g_value_set_uint64 (value, factory->failover_timeout);
+      break;
     case PROP_FIND_DYNAMIC_STREAMS:
       g_value_set_boolean (value, factory->find_dynamic_streams);
       break;
+    case PROP_SDP_PROBE:
+      g_value_set_boolean (value, factory->sdp_probe);
+      break;
     case PROP_TIMEOUT:
       g_value_set_uint64 (value, factory->timeout);
       break;
     case PROP_LATENCY:
       g_value_set_uint64 (value, factory->latency);
       break;
+    case PROP_UDP_BUFFER_SIZE:
+      g_value_set_int (value, factory->udp_buffer_size);
+      break;
+    case PROP_MAX_VARIANTS:
+      g_value_set_uint (value, factory->max_variants);
+      break;
+    case PROP_PREWARM_PAYLOADERS:
+      g_value_set_uint (value, factory->prewarm_payloaders);
+      break;
+    case PROP_MAX_CLIENTS:
+      g_value_set_uint (value, factory->max_clients);
+      break;
+    case PROP_MAX_BANDWIDTH:
+      g_value_set_uint64 (value, factory->max_bandwidth);
+      break;
+    case PROP_BITRATE_ESTIMATE:
+      g_value_set_uint64 (value, factory->bitrate_estimate);
+      break;
+    case PROP_CLIENTS:
+      g_static_mutex_lock (&usage_lock);
+      update_factory_usage_unlocked (factory);
+      g_value_set_uint (value, factory->clients);
+      g_static_mutex_unlock (&usage_lock);
+      break;
+    case PROP_BANDWIDTH:
+      g_static_mutex_lock (&usage_lock);
+      update_factory_usage_unlocked (factory);
+      g_value_set_uint64 (value, factory->bandwidth);
+      g_static_mutex_unlock (&usage_lock);
+      break;
+    case PROP_TASK_POOL:
+      g_value_set_object (value, factory->task_pool);
+      break;
+    case PROP_MEDIAS:
+      g_value_set_int (value, g_atomic_int_get (&factory->medias));
+      break;
+    case PROP_OBJECTS:
+      g_value_set_int (value, g_atomic_int_get (&factory->objects));
+      break;
+    case PROP_OBJECT_BYTES:
+      g_value_set_int (value, g_atomic_int_get (&factory->object_bytes));
+      break;
+    case PROP_PACKETS_RECEIVED:
+    case PROP_STANDBY_PACKETS_RECEIVED:
+      g_mutex_lock (factory->packets_lock);
+      g_value_set_uint64 (value, factory->packets_received[
+          propid == PROP_STANDBY_PACKETS_RECEIVED]);
+      g_mutex_unlock (factory->packets_lock);
+      break;
+    case PROP_PACKETS_LOST:
+    case PROP_STANDBY_PACKETS_LOST:
+      g_mutex_lock (factory->packets_lock);
+      g_value_set_uint64 (value, factory->packets_lost[
+          propid == PROP_STANDBY_PACKETS_LOST]);
+      g_mutex_unlock (factory->packets_lock);
+      break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, propid, pspec);
   }
@@ -207,15 +579,53 @@ gst_rtsp_relay_media_factory_set_property (GObject *object, guint propid,
       g_free (factory->location);
       factory->location = g_value_dup_string (value);
       break;
+    case PROP_STANDBY_LOCATION:
+      g_free (factory->standby_location);
+      factory->standby_location = g_value_dup_string (value);
+      break;
+    case PROP_FAILOVER_TIMEOUT:
+      factory->failover_timeout = g_value_get_uint64 (value);
+      break;
     case PROP_FIND_DYNAMIC_STREAMS:
       factory->find_dynamic_streams = g_value_get_boolean (value);
       break;
+    case PROP_SDP_PROBE:
+      factory->sdp_probe = g_value_get_boolean (value);
+      break;
     case PROP_TIMEOUT:
       factory->timeout = g_value_get_uint64 (value);
       break;
     case PROP_LATENCY:
       factory->latency = g_value_get_uint64 (value);
       break;
+    case PROP_UDP_BUFFER_SIZE:
+      factory->udp_buffer_size = g_value_get_int (value);
+      break;
+    case PROP_MAX_VARIANTS:
+      factory->max_variants = g_value_get_uint (value);
+      break;
+    case PROP_PREWARM_PAYLOADERS:
+      factory->prewarm_payloaders = g_value_get_uint (value);
+      prewarm_payloaders (factory);
+      break;
+    case PROP_MAX_CLIENTS:
+      factory->max_clients = g_value_get_uint (value);
+      break;
+    case PROP_MAX_BANDWIDTH:
+      factory->max_bandwidth = g_value_get_uint64 (value);
+      break;
+    case PROP_BITRATE_ESTIMATE:
+      g_static_mutex_lock (&usage_lock);
+      factory->bitrate_estimate = g_value_get_uint64 (value);
+      if (g_atomic_int_get (&factory->medias) == 0)
+        factory->media_bitrate = factory->bitrate_estimate;
+      g_static_mutex_unlock (&usage_lock);
+      break;
+    case PROP_TASK_POOL:
+      if (factory->task_pool)
+        gst_object_unref (factory->task_pool);
+      factory->task_pool = g_value_dup_object (value);
+      break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, propid, pspec);
   }
@@ -231,6 +641,290 @@ GstRTSPRelayMediaFactory * gst_rtsp_relay_media_factory_new (const char *url)
   return factory;
 }
 
+void
+gst_rtsp_relay_media_factory_set_global_limits (guint max_clients,
+    guint64 max_bandwidth)
+{
+  g_static_mutex_lock (&usage_lock);
+  global_max_clients = max_clients;
+  global_max_bandwidth = max_bandwidth;
+  g_static_mutex_unlock (&usage_lock);
+}
+
+static void
+update_factory_usage_unlocked (GstRTSPRelayMediaFactory *factory)
+{
+  GstRTSPMediaFactory *media_factory = GST_RTSP_MEDIA_FACTORY (factory);
+  GHashTableIter iter;
+  gpointer value;
+  GstRTSPMedia *media;
+  MediaStats *stats;
+  GTimeVal now_tv;
+  GstClockTime now;
+  guint64 bytes, bitrate;
+  guint streams, media_clients, started, expired;
+  guint clients = 0;
+  guint64 bandwidth = 0, media_bitrate = 0;
+  gboolean have_medias = FALSE;
+
+  /* don't wait for a factory that is busy constructing a media, its last
+   * sample is good enough */
+  if (!g_mutex_trylock (media_factory->medias_lock))
+    return;
+
+  g_get_current_time (&now_tv);
+  now = GST_TIMEVAL_TO_TIME (now_tv);
+
+  g_hash_table_iter_init (&iter, media_factory->medias);
+  while (g_hash_table_iter_next (&iter, NULL, &value)) {
+    media = GST_RTSP_MEDIA (value);
+    stats = g_object_get_data (G_OBJECT (media->element), "relay::stats");
+    if (stats == NULL)
+      continue;
+
+    if (stats->last_sample == 0) {
+      stats->last_sample = now;
+    } else if (now - stats->last_sample >= GST_SECOND) {
+      g_static_mutex_lock (&stats->lock);
+      bytes = stats->bytes;
+      stats->bytes = 0;
+      g_static_mutex_unlock (&stats->lock);
+      stats->bitrate = gst_util_uint64_scale (bytes * 8,
+          GST_SECOND, now - stats->last_sample);
+      stats->last_sample = now;
+      stats->sampled = TRUE;
+    }
+
+    /* a media that just started sends nothing yet, count it at the estimate
+     * so that a cold start burst can't overshoot the limits */
+    bitrate = stats->sampled ? stats->bitrate : factory->bitrate_estimate;
+    have_medias = TRUE;
+
+    /* active counts the playing transports of all the streams */
+    streams = media->streams ? media->streams->len : 0;
+    media_clients = streams ? media->active / streams : 0;
+
+    clients += media_clients;
+    bandwidth += bitrate * media_clients;
+    media_bitrate = MAX (media_bitrate, bitrate);
+  }
+  if (!have_medias)
+    media_bitrate = factory->bitrate_estimate;
+
+  g_mutex_unlock (media_factory->medias_lock);
+
+  /* admitted clients stop being pending once they play, or when they don't
+   * get to play within ADMISSION_TIMEOUT */
+  started = clients > factory->playing ? clients - factory->playing : 0;
+  started = MIN (started, factory->pending->len);
+  for (expired = started; expired < factory->pending->len; expired++) {
+    if (now < g_array_index (factory->pending, GstClockTime, expired) +
+        ADMISSION_TIMEOUT)
+      break;
+  }
+  g_array_remove_range (factory->pending, 0, expired);
+  factory->playing = clients;
+
+  factory->clients = clients + factory->pending->len;
+  factory->bandwidth = bandwidth + media_bitrate * factory->pending->len;
+  factory->media_bitrate = media_bitrate;
+}
+
+/* count a client admitted by gen_key until it plays, so that a burst of
+ * DESCRIBE and SETUP requests can't overshoot the limits. Must be called
+ * with usage_lock. */
+static void
+add_pending_client_unlocked (GstRTSPRelayMediaFactory *factory)
+{
+  GTimeVal now_tv;
+  GstClockTime now;
+
+  g_get_current_time (&now_tv);
+  now = GST_TIMEVAL_TO_TIME (now_tv);
+  g_array_append_val (factory->pending, now);
+
+  factory->clients += 1;
+  factory->bandwidth += factory->media_bitrate;
+}
+
+static void
+update_global_usage_unlocked (guint *clients, guint64 *bandwidth)
+{
+  GList *walk;
+  GstRTSPRelayMediaFactory *factory;
+
+  *clients = 0;
+  *bandwidth = 0;
+  for (walk = factories; walk != NULL; walk = walk->next) {
+    factory = GST_RTSP_RELAY_MEDIA_FACTORY (walk->data);
+
+    update_factory_usage_unlocked (factory);
+    *clients += factory->clients;
+    *bandwidth += factory->bandwidth;
+  }
+}
+
+void
+gst_rtsp_relay_media_factory_get_global_usage (guint *clients,
+    guint64 *bandwidth)
+{
+  g_static_mutex_lock (&usage_lock);
+  update_global_usage_unlocked (clients, bandwidth);
+  g_static_mutex_unlock (&usage_lock);
+}
+
+/* decide whether one more client fits, assuming it costs as much as the
+ * most expensive media of the factory. Must be called with usage_lock. */
+static gboolean
+check_admission_unlocked (GstRTSPRelayMediaFactory *factory)
+{
+  GList *walk;
+  GstRTSPRelayMediaFactory *other;
+  guint clients = 0;
+  guint64 bandwidth = 0;
+
+  for (walk = factories; walk != NULL; walk = walk->next) {
+    other = GST_RTSP_RELAY_MEDIA_FACTORY (walk->data);
+    clients += other->clients;
+    bandwidth += other->bandwidth;
+  }
+
+  if (factory->max_clients && factory->clients >= factory->max_clients) {
+    GST_WARNING_OBJECT (factory, "refusing client, %d clients",
+        factory->clients);
+    return FALSE;
+  }
+
+  if (global_max_clients && clients >= global_max_clients) {
+    GST_WARNING_OBJECT (factory, "refusing client, %d total clients",
+        clients);
+    return FALSE;
+  }
+
+  if (factory->max_bandwidth &&
+      factory->bandwidth + factory->media_bitrate > factory->max_bandwidth) {
+    GST_WARNING_OBJECT (factory, "refusing client, bandwidth %"
+        G_GUINT64_FORMAT " media bitrate %" G_GUINT64_FORMAT,
+        factory->bandwidth, factory->media_bitrate);
+    return FALSE;
+  }
+
+  if (global_max_bandwidth &&
+      bandwidth + factory->media_bitrate > global_max_bandwidth) {
+    GST_WARNING_OBJECT (factory, "refusing client, total bandwidth %"
+        G_GUINT64_FORMAT " media bitrate %" G_GUINT64_FORMAT,
+        bandwidth, factory->media_bitrate);
+    return FALSE;
+  }
+
+  return TRUE;
+}
+
+static void
+untrack_object (gpointer data, GObject *object)
+{
+  GstRTSPRelayMediaFactory *factory = GST_RTSP_RELAY_MEDIA_FACTORY (data);
+  GTypeQuery query;
+
+  g_type_query (G_OBJECT_TYPE (object), &query);
+  g_atomic_int_add (&factory->objects, -1);
+  g_atomic_int_add (&factory->object_bytes, -(gint) query.instance_size);
+  g_object_unref (factory);
+}
+
+static void
+bin_element_added_cb (GstBin *bin, GstElement *element,
+    GstRTSPRelayMediaFactory *factory)
+{
+  track_element (factory, element);
+}
+
+/* account element and the elements that are or will be added to it to
+ * factory until they're disposed */
+static void
+track_element (GstRTSPRelayMediaFactory *factory, GstElement *element)
+{
+  GTypeQuery query;
+  GList *walk;
+
+  g_type_query (G_OBJECT_TYPE (element), &query);
+  g_atomic_int_add (&factory->objects, 1);
+  g_atomic_int_add (&factory->object_bytes, query.instance_size);
+  g_object_weak_ref (G_OBJECT (element), untrack_object,
+      g_object_ref (factory));
+  g_object_set_data (G_OBJECT (element), "relay::tracked", factory);
+
+  if (!GST_IS_BIN (element))
+    return;
+
+  /* rtspsrc and rtpbin create their children when streaming starts */
+  g_signal_connect (element, "element-added",
+      G_CALLBACK (bin_element_added_cb), factory);
+
+  GST_OBJECT_LOCK (element);
+  for (walk = GST_BIN_CHILDREN (element); walk != NULL; walk = walk->next)
+    track_element (factory, GST_ELEMENT (walk->data));
+  GST_OBJECT_UNLOCK (element);
+}
+
+/* stop accounting element, which is about to be recycled */
+static void
+untrack_element (GstElement *element)
+{
+  GstRTSPRelayMediaFactory *factory;
+  GList *walk;
+
+  factory = g_object_get_data (G_OBJECT (element), "relay::tracked");
+  if (factory == NULL)
+    return;
+
+  g_object_set_data (G_OBJECT (element), "relay::tracked", NULL);
+  g_object_weak_unref (G_OBJECT (element), untrack_object, factory);
+  untrack_object (factory, G_OBJECT (element));
+
+  if (!GST_IS_BIN (element))
+    return;
+
+  g_signal_handlers_disconnect_by_func (element, bin_element_added_cb, factory);
+
+  GST_OBJECT_LOCK (element);
+  for (walk = GST_BIN_CHILDREN (element); walk != NULL; walk = walk->next)
+    untrack_element (GST_ELEMENT (walk->data));
+  GST_OBJECT_UNLOCK (element);
+}
+
+static void
+untrack_media (gpointer data, GObject *bin)
+{
+  GstRTSPRelayMediaFactory *factory = GST_RTSP_RELAY_MEDIA_FACTORY (data);
+
+  g_atomic_int_add (&factory->medias, -1);
+  g_object_unref (factory);
+}
+
+static void
+track_media (GstRTSPRelayMediaFactory *factory, GstBin *bin)
+{
+  g_atomic_int_add (&factory->medias, 1);
+  g_object_weak_ref (G_OBJECT (bin), untrack_media, g_object_ref (factory));
+
+  track_element (factory, GST_ELEMENT (bin));
+
+  GST_DEBUG_OBJECT (factory, "%d medias, %d objects, %d bytes",
+      g_atomic_int_get (&factory->medias), g_atomic_int_get (&factory->objects),
+      g_atomic_int_get (&factory->object_bytes));
+}
+
+static gboolean
+stats_buffer_probe_cb (GstPad *pad, GstBuffer *buffer, MediaStats *stats)
+{
+  g_static_mutex_lock (&stats->lock);
+  stats->bytes += GST_BUFFER_SIZE (buffer);
+  g_static_mutex_unlock (&stats->lock);
+
+  return TRUE;
+}
+
 static void
 rtspsrc_pad_blocked_cb_block (GstPad *pad, gboolean blocked, gpointer data)
 {
@@ -259,10 +953,134 @@ rtspsrc_pad_added_cb_block (GstElement *rtspsrc, GstPad *pad,
   gst_pad_set_blocked_async (pad, TRUE, rtspsrc_pad_blocked_cb_block, factory);
 }
 
+static gboolean
+failover_buffer_probe_cb (GstPad *pad, GstBuffer *buffer, FailoverState *state)
+{
+  GstClockTime now = gst_util_get_timestamp ();
+
+  GST_OBJECT_LOCK (state->selector);
+  if (!GST_CLOCK_TIME_IS_VALID (state->first_packet))
+    state->first_packet = now;
+  if (pad == state->primary)
+    state->last_primary = now;
+  else
+    state->last_standby = now;
+  GST_OBJECT_UNLOCK (state->selector);
+
+  return TRUE;
+}
+
+static void
+failover_add_pad (GstElement *selector, GstPad *pad, gboolean standby)
+{
+  FailoverState *state;
+  GstPad *old = NULL;
+  gboolean was_active = FALSE;
+
+  state = g_object_get_data (G_OBJECT (selector), "relay::failover");
+
+  GST_OBJECT_LOCK (selector);
+  if (standby) {
+    /* the standby reconnected, its old pad is left unlinked */
+    old = state->standby;
+    was_active = state->on_standby;
+    state->standby = pad;
+    state->last_standby = GST_CLOCK_TIME_NONE;
+    state->on_standby = FALSE;
+  } else {
+    state->primary = pad;
+  }
+  GST_OBJECT_UNLOCK (selector);
+
+  if (old) {
+    if (was_active && state->primary)
+      g_object_set (selector, "active-pad", state->primary, NULL);
+    gst_element_release_request_pad (selector, old);
+  }
+
+  gst_pad_add_buffer_probe (pad, G_CALLBACK (failover_buffer_probe_cb), state);
+
+  if (!standby)
+    g_object_set (selector, "active-pad", pad, NULL);
+}
+
+/* the standby upstream can't be left with unlinked pads */
+static void
+link_fakesink (GstRTSPRelayMediaFactory *factory, GstPad *pad)
+{
+  GstElement *fakesink;
+  GstPad *sink;
+
+  fakesink = gst_element_factory_make ("fakesink", NULL);
+  g_object_set (fakesink, "sync", FALSE, "async", FALSE, NULL);
+  gst_bin_add (GST_BIN (GST_ELEMENT_PARENT (GST_PAD_PARENT (pad))), fakesink);
+  gst_element_sync_state_with_parent (fakesink);
+
+  sink = gst_element_get_static_pad (fakesink, "sink");
+  if (gst_pad_link (pad, sink) != GST_PAD_LINK_OK)
+    GST_ERROR_OBJECT (factory, "couldn't link %s:%s to fakesink",
+        GST_DEBUG_PAD_NAME (pad));
+  gst_object_unref (sink);
+}
+
+/* link a pad of the standby upstream to the selector of the stream it
+ * matches in its own media bin. The selectors stay there so that the
+ * standby can reconnect to them, unlike the primary payloaders which are
+ * consumed. */
+static void
+link_standby (GstRTSPRelayMediaFactory *factory, GstPad *pad)
+{
+  GstElement *bin;
+  GPtrArray *states;
+  FailoverState *state;
+  GstCaps *pad_caps, *intersect;
+  GstPad *sink;
+  gboolean found = FALSE, available;
+  guint i;
+
+  bin = GST_ELEMENT_PARENT (GST_PAD_PARENT (pad));
+  states = g_object_get_data (G_OBJECT (bin), "relay::failover");
+
+  pad_caps = gst_pad_get_caps (pad);
+  for (i = 0; states && i < states->len && !found; i++) {
+    state = g_ptr_array_index (states, i);
+
+    GST_OBJECT_LOCK (state->selector);
+    available = state->standby == NULL ||
+        !gst_pad_is_linked (state->standby);
+    GST_OBJECT_UNLOCK (state->selector);
+    if (!available)
+      continue;
+
+    intersect = gst_caps_intersect (state->caps, pad_caps);
+    if (!gst_caps_is_empty (intersect)) {
+      sink = gst_element_get_request_pad (state->selector, "sink%d");
+      if (gst_pad_link (pad, sink) == GST_PAD_LINK_OK) {
+        failover_add_pad (state->selector, sink, TRUE);
+        found = TRUE;
+      } else {
+        GST_ERROR_OBJECT (factory, "couldn't link standby %s:%s",
+            GST_DEBUG_PAD_NAME (pad));
+        gst_element_release_request_pad (state->selector, sink);
+      }
+      gst_object_unref (sink);
+    }
+    gst_caps_unref (intersect);
+  }
+  gst_caps_unref (pad_caps);
+
+  if (!found) {
+    GST_WARNING_OBJECT (factory, "no stream for standby %s:%s",
+        GST_DEBUG_PAD_NAME (pad));
+    link_fakesink (factory, pad);
+  }
+}
+
 static void
 do_dynamic_link (GstRTSPRelayMediaFactory *factory, GstPad *pad)
 {
   GList *walk, *del;
+  GQueue *dynamic_payloaders;
   GstCaps *pad_caps, *intersect;
   gboolean found;
   GstPad *sink;
@@ -271,31 +1089,49 @@ do_dynamic_link (GstRTSPRelayMediaFactory *factory, GstPad *pad)
   GST_DEBUG_OBJECT (factory, "trying to link dynamic %s:%s %"GST_PTR_FORMAT,
       GST_DEBUG_PAD_NAME (pad), GST_PAD_CAPS (pad));
 
+  /* the payloaders of the media bin the rtspsrc of pad is in, other medias
+   * of the factory can be built while this one waits for its pads */
+  dynamic_payloaders = g_object_get_data (
+      G_OBJECT (GST_ELEMENT_PARENT (GST_PAD_PARENT (pad))), "relay::payloaders");
+  if (dynamic_payloaders == NULL) {
+    GST_WARNING_OBJECT (factory, "no payloaders for %s:%s",
+        GST_DEBUG_PAD_NAME (pad));
+    return;
+  }
+
   found = FALSE;
-  walk = factory->dynamic_payloaders;
+  walk = dynamic_payloaders->head;
   while (walk && !found) {
     dynamic_payloader = (DynamicPayloader *) walk->data;
 
     pad_caps = gst_pad_get_caps (pad);
     intersect = gst_caps_intersect (dynamic_payloader->caps, pad_caps);
 
-    GST_DEBUG_OBJECT (factory, "trying %s", gst_caps_to_string (intersect));
+    GST_DEBUG_OBJECT (factory, "trying %" GST_PTR_FORMAT, intersect);
 
     if (!gst_caps_is_empty (intersect)) {
-      GST_DEBUG_OBJECT (factory, "matches %s", gst_caps_to_string (intersect));
+      GST_DEBUG_OBJECT (factory, "matches %" GST_PTR_FORMAT, intersect);
 
-      sink = gst_element_get_static_pad (dynamic_payloader->payloader, "sink");
+      if (dynamic_payloader->selector)
+        sink = gst_element_get_request_pad (dynamic_payloader->selector,
+            "sink%d");
+      else
+        sink = gst_element_get_static_pad (dynamic_payloader->payloader, "sink");
       link_ret = gst_pad_link (pad, sink);
       if (link_ret == GST_PAD_LINK_OK) {
         found = TRUE;
 
+        if (dynamic_payloader->selector)
+          failover_add_pad (dynamic_payloader->selector, sink, FALSE);
+
         del = walk;
         walk = walk->next;
-        factory->dynamic_payloaders =
-            g_list_delete_link (factory->dynamic_payloaders, del);
+        g_queue_delete_link (dynamic_payloaders, del);
         dynamic_payloader_free (dynamic_payloader);
       } else {
         GST_ERROR_OBJECT (factory, "couldn't link pads");
+        if (dynamic_payloader->selector)
+          gst_element_release_request_pad (dynamic_payloader->selector, sink);
         walk = walk->next;
       }
 
@@ -311,15 +1147,13 @@ do_dynamic_link (GstRTSPRelayMediaFactory *factory, GstPad *pad)
 
   if (!found)
     GST_WARNING_OBJECT (factory, "couldn't find dynamic payloader");
-  
-  gst_pad_set_blocked_async (pad, FALSE,
-      rtspsrc_pad_blocked_cb_link_dynamic, factory);
 }
 
 static void
 rtspsrc_pad_blocked_cb_link_dynamic (GstPad *pad, gboolean blocked, gpointer user_data)
 {
   GstRTSPRelayMediaFactory *factory = GST_RTSP_RELAY_MEDIA_FACTORY (user_data);
+  gboolean standby;
  
   if (!blocked) {
     GST_DEBUG_OBJECT (factory, "unblocked dynamic %s:%s %"GST_PTR_FORMAT,
@@ -327,9 +1161,76 @@ rtspsrc_pad_blocked_cb_link_dynamic (GstPad *pad, gboolean blocked, gpointer use
     return;
   }
 
-  g_mutex_lock (factory->lock);
-  do_dynamic_link (factory, pad);
-  g_mutex_unlock (factory->lock);
+  standby = g_object_get_data (G_OBJECT (GST_PAD_PARENT (pad)),
+      "relay::standby") != NULL;
+
+  if (standby) {
+    link_standby (factory, pad);
+  } else {
+    g_mutex_lock (factory->lock);
+    do_dynamic_link (factory, pad);
+    g_mutex_unlock (factory->lock);
+  }
+
+  gst_pad_set_blocked_async (pad, FALSE,
+      rtspsrc_pad_blocked_cb_link_dynamic, factory);
+}
+
+typedef struct
+{
+  GstRTSPRelayMediaFactory *factory;
+  /* index of the counters, 1 for the standby upstream */
+  guint upstream;
+  gboolean have_seq;
+  guint16 last_seq;
+} LossState;
+
+/* runs after the jitterbuffer, so a sequence gap is a packet that was never
+ * received or arrived too late */
+static gboolean
+loss_buffer_probe_cb (GstPad *pad, GstBuffer *buffer, LossState *state)
+{
+  guint16 seq, gap;
+
+  if (!gst_rtp_buffer_validate (buffer))
+    return TRUE;
+
+  seq = gst_rtp_buffer_get_seq (buffer);
+  gap = 0;
+  if (state->have_seq) {
+    gap = seq - state->last_seq - 1;
+    /* ignore duplicates and reordered packets */
+    if (gap >= 0x8000)
+      gap = 0;
+    else if (gap != 0)
+      GST_LOG_OBJECT (state->factory, "%s:%s lost %d packets",
+          GST_DEBUG_PAD_NAME (pad), gap);
+  }
+
+  g_mutex_lock (state->factory->packets_lock);
+  state->factory->packets_received[state->upstream] += 1;
+  state->factory->packets_lost[state->upstream] += gap;
+  g_mutex_unlock (state->factory->packets_lock);
+
+  state->have_seq = TRUE;
+  state->last_seq = seq;
+
+  return TRUE;
+}
+
+static void
+add_loss_probe (GstRTSPRelayMediaFactory *factory, GstPad *pad)
+{
+  LossState *state;
+
+  state = g_new0 (LossState, 1);
+  state->factory = factory;
+  state->upstream = g_object_get_data (G_OBJECT (GST_PAD_PARENT (pad)),
+      "relay::standby") != NULL;
+  state->have_seq = FALSE;
+  g_object_set_data_full (G_OBJECT (pad), "relay::loss", state, g_free);
+
+  gst_pad_add_buffer_probe (pad, G_CALLBACK (loss_buffer_probe_cb), state);
 }
 
 static void
@@ -345,32 +1246,233 @@ rtspsrc_pad_added_cb_link_dynamic (GstElement *rtspsrc, GstPad *pad,
   GST_DEBUG_OBJECT (factory, "got dynamic %s:%s, doing block",
       GST_DEBUG_PAD_NAME (pad));
 
+  add_loss_probe (factory, pad);
+
   gst_pad_set_blocked_async (pad, TRUE,
       rtspsrc_pad_blocked_cb_link_dynamic, factory);
 }
 
-static GstElement *
-create_payloader_from_pad (GstRTSPRelayMediaFactory *factory,
-    GstPad *pad, GstCaps *caps, guint payn)
+static gboolean
+thin_buffer_probe_cb (GstPad *pad, GstBuffer *buffer, ThinState *state)
 {
-  GstElement *payloader;
-  char buf[10];
-  GstPad *srcpad = NULL;
-  int i;
-  const gchar *description = NULL;
-  GstCaps *payloader_caps, *intersect;
-  gboolean empty;
+  gboolean keyframe;
 
-  for (i = 0; payloader_bins[i].description != NULL; i++) {
-    payloader_caps = gst_static_caps_get (payloader_bins[i].caps);
-    intersect = gst_caps_intersect (caps, payloader_caps);
-    empty = gst_caps_is_empty (intersect);
-    gst_caps_unref (intersect);
-    gst_caps_unref (payloader_caps);
+  keyframe = !GST_BUFFER_FLAG_IS_SET (buffer, GST_BUFFER_FLAG_DELTA_UNIT);
+  if (keyframe)
+    state->passing = (state->keyframes++ % state->interval) == 0;
 
-    if (!empty) {
-      description = payloader_bins[i].description;
-      GST_INFO_OBJECT (factory, "using description %s", description);
+  if (state->variant == GST_RTSP_RELAY_VARIANT_KEYFRAMES)
+    return keyframe && state->passing;
+
+  return state->passing;
+}
+
+static void
+add_thin_probe (GstRTSPRelayMediaFactory *factory, GstElement *payloader)
+{
+  GstElement *depay;
+  GstPad *pad;
+  ThinState *state;
+  gulong probe;
+
+  depay = gst_bin_get_by_name (GST_BIN (payloader), "depay");
+  pad = gst_element_get_static_pad (depay, "src");
+
+  state = g_new0 (ThinState, 1);
+  state->variant = factory->variant;
+  state->interval = factory->variant_interval;
+  state->keyframes = 0;
+  state->passing = FALSE;
+  /* the payloader owns the state so it lives as long as the probe */
+  g_object_set_data_full (G_OBJECT (payloader), "relay::thin", state, g_free);
+
+  probe = gst_pad_add_buffer_probe (pad, G_CALLBACK (thin_buffer_probe_cb),
+      state);
+  g_object_set_data (G_OBJECT (payloader), "relay::thin-probe",
+      GUINT_TO_POINTER (probe));
+
+  gst_object_unref (pad);
+  gst_object_unref (depay);
+}
+
+static GstElement *
+payloader_new (const gchar *description)
+{
+  GstElement *payloader;
+  GError *error = NULL;
+
+  /* a missing plugin only fails the codecs that need it */
+  payloader = gst_parse_bin_from_description (description, TRUE, &error);
+  if (error != NULL) {
+    GST_WARNING ("couldn't create payloader %s: %s", description,
+        error->message);
+    g_error_free (error);
+    if (payloader)
+      gst_object_unref (payloader);
+
+    return NULL;
+  }
+
+  gst_object_ref (payloader);
+  gst_object_sink (payloader);
+  g_object_set_data_full (G_OBJECT (payloader), "relay::description",
+      g_strdup (description), g_free);
+
+  return payloader;
+}
+
+static void
+payloader_queue_free (GQueue *queue)
+{
+  g_queue_foreach (queue, (GFunc) gst_object_unref, NULL);
+  g_queue_free (queue);
+}
+
+/* must be called with payloader_pool_lock */
+static GQueue *
+payloader_pool_get_queue_unlocked (GstRTSPRelayMediaFactory *factory,
+    const gchar *description)
+{
+  GQueue *queue;
+
+  queue = g_hash_table_lookup (factory->payloader_pool, description);
+  if (queue == NULL) {
+    queue = g_queue_new ();
+    g_hash_table_insert (factory->payloader_pool, g_strdup (description),
+        queue);
+  }
+
+  return queue;
+}
+
+/* the pool is per factory so that recycled payloaders only ever saw the
+ * streams of the same upstream, rtph264pay keeps the last SPS/PPS it got */
+static void
+prewarm_payloaders (GstRTSPRelayMediaFactory *factory)
+{
+  GQueue *queue;
+  GstElement *payloader;
+  guint i;
+
+  g_mutex_lock (factory->payloader_pool_lock);
+  for (i = 0; payloader_bins[i].description != NULL; i++) {
+    queue = payloader_pool_get_queue_unlocked (factory,
+        payloader_bins[i].description);
+    while (queue->length < factory->prewarm_payloaders) {
+      payloader = payloader_new (payloader_bins[i].description);
+      if (payloader == NULL)
+        break;
+      g_queue_push_tail (queue, payloader);
+    }
+  }
+  g_mutex_unlock (factory->payloader_pool_lock);
+}
+
+/* returns a reference owned by the caller, never a floating one, or NULL if
+ * description can't be built */
+static GstElement *
+payloader_pool_checkout (GstRTSPRelayMediaFactory *factory,
+    const gchar *description)
+{
+  GQueue *queue;
+  GstElement *payloader = NULL;
+
+  g_mutex_lock (factory->payloader_pool_lock);
+  queue = g_hash_table_lookup (factory->payloader_pool, description);
+  if (queue)
+    payloader = g_queue_pop_head (queue);
+  g_mutex_unlock (factory->payloader_pool_lock);
+
+  if (payloader) {
+    GST_DEBUG_OBJECT (factory, "recycling payloader %p for %s", payloader,
+        description);
+
+    return payloader;
+  }
+
+  return payloader_new (description);
+}
+
+static void
+remove_probe (GstElement *element, const gchar *pad_name, gulong probe)
+{
+  GstPad *pad;
+
+  if (probe == 0)
+    return;
+
+  pad = gst_element_get_static_pad (element, pad_name);
+  gst_pad_remove_buffer_probe (pad, probe);
+  gst_object_unref (pad);
+}
+
+/* takes ownership of payloader, which must be unparented and in NULL */
+static void
+payloader_pool_checkin (GstRTSPRelayMediaFactory *factory,
+    GstElement *payloader)
+{
+  const gchar *description;
+  GstElement *depay;
+  GQueue *queue;
+
+  description = g_object_get_data (G_OBJECT (payloader), "relay::description");
+
+  /* drop what the previous media attached */
+  remove_probe (payloader, "src", GPOINTER_TO_UINT (g_object_get_data (
+      G_OBJECT (payloader), "relay::stats-probe")));
+  g_object_set_data (G_OBJECT (payloader), "relay::stats-probe", NULL);
+
+  depay = gst_bin_get_by_name (GST_BIN (payloader), "depay");
+  if (depay) {
+    remove_probe (depay, "src", GPOINTER_TO_UINT (g_object_get_data (
+        G_OBJECT (payloader), "relay::thin-probe")));
+    gst_object_unref (depay);
+  }
+  g_object_set_data (G_OBJECT (payloader), "relay::thin-probe", NULL);
+  g_object_set_data (G_OBJECT (payloader), "relay::thin", NULL);
+
+  untrack_element (payloader);
+
+  g_mutex_lock (factory->payloader_pool_lock);
+  queue = payloader_pool_get_queue_unlocked (factory, description);
+  if (queue->length < PAYLOADER_POOL_MAX) {
+    g_queue_push_tail (queue, payloader);
+    payloader = NULL;
+  }
+  g_mutex_unlock (factory->payloader_pool_lock);
+
+  if (payloader)
+    gst_object_unref (payloader);
+}
+
+static GstElement *
+create_payloader_from_pad (GstRTSPRelayMediaFactory *factory,
+    GstPad *pad, GstCaps *caps, guint payn)
+{
+  GstElement *payloader;
+  char buf[10];
+  GstPad *srcpad = NULL;
+  int i;
+  const gchar *description = NULL;
+  GstCaps *payloader_caps, *intersect;
+  gboolean empty;
+  gboolean thin = FALSE;
+
+  for (i = 0; payloader_bins[i].description != NULL; i++) {
+    payloader_caps = gst_static_caps_get (payloader_bins[i].caps);
+    intersect = gst_caps_intersect (caps, payloader_caps);
+    empty = gst_caps_is_empty (intersect);
+    gst_caps_unref (intersect);
+    gst_caps_unref (payloader_caps);
+
+    if (!empty) {
+      description = payloader_bins[i].description;
+      if (factory->variant != GST_RTSP_RELAY_VARIANT_FULL &&
+          payloader_bins[i].thin_description != NULL) {
+        description = payloader_bins[i].thin_description;
+        thin = TRUE;
+      }
+      GST_INFO_OBJECT (factory, "using description %s", description);
       break;
     }
   }
@@ -378,7 +1480,15 @@ create_payloader_from_pad (GstRTSPRelayMediaFactory *factory,
   if (description == NULL)
     description = "identity";
 
-  payloader = gst_parse_bin_from_description (description, TRUE, NULL);
+  payloader = payloader_pool_checkout (factory, description);
+  if (payloader == NULL) {
+    GST_WARNING_OBJECT (factory, "relaying the stream unchanged instead");
+    payloader = payloader_pool_checkout (factory, "identity");
+    thin = FALSE;
+  }
+
+  if (thin)
+    add_thin_probe (factory, payloader);
 
   g_snprintf (buf, 10, "pay%d", payn);
   gst_element_set_name (payloader, (const char *) &buf);
@@ -411,6 +1521,159 @@ get_payloader_caps (GstCaps *caps)
   return ret;
 }
 
+/* put an input-selector in front of the payloader so that it can be fed by
+ * either upstream, and let the standby upstream link to it too */
+static void
+add_failover_selector (GstRTSPRelayMediaFactory *factory, GstBin *bin,
+    DynamicPayloader *dynamic_payloader)
+{
+  GstElement *selector;
+  GPtrArray *states;
+  FailoverState *state;
+
+  selector = gst_element_factory_make ("input-selector", NULL);
+  gst_bin_add (bin, selector);
+  if (!gst_element_link (selector, dynamic_payloader->payloader)) {
+    GST_ERROR_OBJECT (factory, "couldn't link selector to %s",
+        GST_OBJECT_NAME (dynamic_payloader->payloader));
+    gst_bin_remove (bin, selector);
+    return;
+  }
+
+  states = g_object_get_data (G_OBJECT (bin), "relay::failover");
+  if (states == NULL) {
+    states = g_ptr_array_new ();
+    g_object_set_data_full (G_OBJECT (bin), "relay::failover", states,
+        (GDestroyNotify) failover_states_free);
+  }
+
+  state = g_new0 (FailoverState, 1);
+  state->selector = selector;
+  state->first_packet = GST_CLOCK_TIME_NONE;
+  state->last_primary = GST_CLOCK_TIME_NONE;
+  state->last_standby = GST_CLOCK_TIME_NONE;
+  state->on_standby = FALSE;
+  state->timeout = factory->failover_timeout;
+  state->caps = gst_caps_ref (dynamic_payloader->caps);
+  g_ptr_array_add (states, state);
+  g_object_set_data (G_OBJECT (selector), "relay::failover", state);
+
+  dynamic_payloader->selector = gst_object_ref (selector);
+}
+
+static gboolean
+failover_watchdog_cb (GstBin *bin)
+{
+  GPtrArray *states;
+  FailoverState *state;
+  GstClockTime now, first_packet, last_active, last_other;
+  GstPad *other;
+  guint i;
+
+  /* the media dropped the bin, only the watchdog holds it */
+  if (GST_OBJECT_REFCOUNT_VALUE (bin) == 1)
+    return FALSE;
+
+  states = g_object_get_data (G_OBJECT (bin), "relay::failover");
+  if (states == NULL)
+    return FALSE;
+
+  now = gst_util_get_timestamp ();
+
+  for (i = 0; i < states->len; i++) {
+    state = g_ptr_array_index (states, i);
+
+    GST_OBJECT_LOCK (state->selector);
+    first_packet = state->first_packet;
+    if (state->on_standby) {
+      last_active = state->last_standby;
+      last_other = state->last_primary;
+      other = state->primary;
+    } else {
+      last_active = state->last_primary;
+      last_other = state->last_standby;
+      other = state->standby;
+    }
+    GST_OBJECT_UNLOCK (state->selector);
+
+    /* switch only when the active upstream stalled while the other one is
+     * still flowing, and stay there until that one stalls too */
+    if (other == NULL || !GST_CLOCK_TIME_IS_VALID (last_other) ||
+        now - last_other >= state->timeout)
+      continue;
+
+    if (GST_CLOCK_TIME_IS_VALID (last_active) &&
+        now - last_active < state->timeout)
+      continue;
+
+    /* an upstream that didn't deliver yet, like a primary connecting slower
+     * than the standby, hasn't stalled until the grace period is over */
+    if (!GST_CLOCK_TIME_IS_VALID (last_active) &&
+        now - first_packet < FAILOVER_STARTUP_GRACE)
+      continue;
+
+    GST_WARNING_OBJECT (bin, "%s stalled, switching %s to %s:%s",
+        state->on_standby ? "standby" : "primary",
+        GST_OBJECT_NAME (state->selector), GST_DEBUG_PAD_NAME (other));
+    g_object_set (state->selector, "active-pad", other, NULL);
+    state->on_standby = !state->on_standby;
+  }
+
+  return TRUE;
+}
+
+static int
+add_dynamic_payloaders (GstRTSPRelayMediaFactory *factory, GstBin *bin)
+{
+  GList *walk;
+  GQueue *dynamic_payloaders;
+  GstElement *payloader;
+  GstPad *srcpad;
+  gulong probe;
+  guint num_streams;
+
+  if (!factory->dynamic_payloaders)
+    return 0;
+
+  num_streams = 0;
+  for (walk = factory->dynamic_payloaders; walk != NULL; walk = walk->next) {
+    gchar *capss;
+
+    DynamicPayloader *dynamic_payloader = (DynamicPayloader *) walk->data;
+
+    capss = gst_caps_to_string (dynamic_payloader->caps);
+    GST_INFO_OBJECT (factory, "created new payloader %s caps %s",
+        GST_OBJECT_NAME (dynamic_payloader->payloader), capss);
+    g_free (capss);
+
+    payloader = dynamic_payloader->payloader;
+    gst_bin_add (bin, payloader);
+    num_streams += 1;
+
+    if (factory->standby_location)
+      add_failover_selector (factory, bin, dynamic_payloader);
+
+    srcpad = gst_element_get_static_pad (payloader, "src");
+    probe = gst_pad_add_buffer_probe (srcpad,
+        G_CALLBACK (stats_buffer_probe_cb),
+        g_object_get_data (G_OBJECT (bin), "relay::stats"));
+    g_object_set_data (G_OBJECT (payloader), "relay::stats-probe",
+        GUINT_TO_POINTER (probe));
+    gst_object_unref (srcpad);
+  }
+
+  /* hand the list over to the media, pads link to it once it plays */
+  dynamic_payloaders = g_queue_new ();
+  for (walk = factory->dynamic_payloaders; walk != NULL; walk = walk->next)
+    g_queue_push_tail (dynamic_payloaders, walk->data);
+  g_list_free (factory->dynamic_payloaders);
+  factory->dynamic_payloaders = NULL;
+  g_object_set_data_full (G_OBJECT (bin), "relay::payloaders",
+      dynamic_payloaders, (GDestroyNotify) dynamic_payloaders_free);
+
+  return num_streams;
+}
+
 static int
 create_payloaders_from_element_pads (GstRTSPRelayMediaFactory *factory,
     GstElement *rtspsrc, GstBin *bin)
@@ -421,11 +1684,9 @@ create_payloaders_from_element_pads (GstRTSPRelayMediaFactory *factory,
   gpointer elem;
   GstPad *pad;
   guint payn;
-  guint num_streams = 0;
   GstElement *payloader;
   GstCaps *caps;
   DynamicPayloader *dynamic_payloader;
-  GList *walk;
 
   iterator = gst_element_iterate_src_pads (rtspsrc);
 
@@ -470,26 +1731,7 @@ restart:
   }
   gst_iterator_free (iterator);
 
-  if (!factory->dynamic_payloaders)
-    return 0;
-
-  num_streams = 0;
-  for (walk = factory->dynamic_payloaders; walk != NULL; walk = walk->next) {
-    gchar *capss;
-
-    DynamicPayloader *dynamic_payloader = (DynamicPayloader *) walk->data;
-
-    capss = gst_caps_to_string (dynamic_payloader->caps);
-    GST_INFO_OBJECT (factory, "created new payloader %s caps %s",
-        GST_OBJECT_NAME (dynamic_payloader->payloader), capss);
-    g_free (capss);
-
-    payloader = dynamic_payloader->payloader;
-    gst_bin_add (bin, payloader);
-    num_streams += 1;
-  }
-
-  return num_streams;
+  return add_dynamic_payloaders (factory, bin);
 }
 
 static void
@@ -549,9 +1791,9 @@ do_find_dynamic_streams (GstRTSPRelayMediaFactory *factory, GstBin *bin,
       G_CALLBACK (bus_message_error_cb), factory, NULL);
   gst_object_unref (bus);
 
-  gst_object_ref (bin);
-  gst_object_sink (bin);
-  gst_bin_add (GST_BIN (pipeline), GST_ELEMENT (bin));
+  /* only rtspsrc goes in the probe pipeline, the caller owns a reference to
+   * it and bin stays a new floating bin for get_element to hand out */
+  gst_bin_add (GST_BIN (pipeline), rtspsrc);
 
   factory->pads_waiting_block = 0;
   factory->rtspsrc_no_more_pads = FALSE;
@@ -593,9 +1835,8 @@ out:
       "any_signal::no-more-pads", G_CALLBACK (rtspsrc_no_more_pads_cb), factory,
       NULL);
 
-  gst_bin_remove (GST_BIN (pipeline), GST_ELEMENT (bin));
+  gst_bin_remove (GST_BIN (pipeline), rtspsrc);
   gst_object_unref (pipeline);
-  //gst_object_unref (bin);
 
   /* connect to pad-added again to link dynamic payloaders */
   g_object_connect (G_OBJECT (rtspsrc),
@@ -605,45 +1846,509 @@ out:
   return num_streams;
 }
 
+static GstCaps *
+get_sdp_media_caps (const GstSDPMedia *media)
+{
+  const gchar *format, *rtpmap, *end;
+  gchar *encoding_name = NULL;
+  GstCaps *caps;
+  gint pt;
+  guint i;
+
+  format = gst_sdp_media_get_format (media, 0);
+  if (format == NULL)
+    return NULL;
+
+  pt = atoi (format);
+
+  /* a=rtpmap:<pt> <encoding-name>/<clock-rate>[/<params>] */
+  for (i = 0; (rtpmap = gst_sdp_media_get_attribute_val_n (media,
+          "rtpmap", i)) != NULL; i++) {
+    if (atoi (rtpmap) != pt)
+      continue;
+
+    rtpmap = strchr (rtpmap, ' ');
+    if (rtpmap == NULL)
+      break;
+
+    while (*rtpmap == ' ')
+      rtpmap++;
+
+    end = strchr (rtpmap, '/');
+    encoding_name = g_ascii_strup (rtpmap, end ? end - rtpmap : -1);
+    break;
+  }
+
+  /* the only static payload type we know how to relay */
+  if (encoding_name == NULL && pt == 14)
+    encoding_name = g_strdup ("MPA");
+
+  if (encoding_name == NULL)
+    return NULL;
+
+  caps = gst_caps_new_simple ("application/x-rtp",
+      "encoding-name", G_TYPE_STRING, encoding_name,
+      "media", G_TYPE_STRING, gst_sdp_media_get_media (media), NULL);
+  g_free (encoding_name);
+
+  return caps;
+}
+
+static int
+create_payloaders_from_sdp (GstRTSPRelayMediaFactory *factory,
+    GstSDPMessage *sdp, GstBin *bin)
+{
+  guint i;
+  guint payn = 0;
+  GstCaps *caps;
+  GstElement *payloader;
+  DynamicPayloader *dynamic_payloader;
+
+  if (factory->dynamic_payloaders) {
+    g_list_foreach (factory->dynamic_payloaders,
+        (GFunc) dynamic_payloader_free, NULL);
+    g_list_free (factory->dynamic_payloaders);
+  }
+  factory->dynamic_payloaders = NULL;
+
+  for (i = 0; i < gst_sdp_message_medias_len (sdp); i++) {
+    caps = get_sdp_media_caps (gst_sdp_message_get_media (sdp, i));
+    if (caps == NULL) {
+      /* rtspsrc would expose a pad we have no payloader for */
+      GST_WARNING_OBJECT (factory, "can't map sdp media %d to caps", i);
+      g_list_foreach (factory->dynamic_payloaders,
+          (GFunc) dynamic_payloader_free, NULL);
+      g_list_free (factory->dynamic_payloaders);
+      factory->dynamic_payloaders = NULL;
+
+      return 0;
+    }
+
+    payloader = create_payloader_from_pad (factory, NULL, caps, payn++);
+    dynamic_payloader = dynamic_payloader_new (payloader, caps);
+    factory->dynamic_payloaders =
+        g_list_append (factory->dynamic_payloaders, dynamic_payloader);
+  }
+
+  return add_dynamic_payloaders (factory, bin);
+}
+
+/* set up auth on connection from a WWW-Authenticate header, which looks like
+ * Digest realm="x", nonce="y", ... or Basic realm="x" */
+static gboolean
+setup_describe_auth (GstRTSPRelayMediaFactory *factory,
+    GstRTSPConnection *connection, GstRTSPUrl *url, const gchar *header)
+{
+  gchar **params, **param, **pair;
+  GstRTSPAuthMethod method;
+
+  if (url->user == NULL || url->passwd == NULL) {
+    GST_WARNING_OBJECT (factory, "upstream wants auth but location has no "
+        "credentials");
+    return FALSE;
+  }
+
+  if (g_ascii_strncasecmp (header, "Digest ", 7) == 0) {
+    method = GST_RTSP_AUTH_DIGEST;
+    header += 7;
+  } else if (g_ascii_strncasecmp (header, "Basic", 5) == 0) {
+    method = GST_RTSP_AUTH_BASIC;
+    header += 5;
+  } else {
+    GST_WARNING_OBJECT (factory, "unsupported auth %s", header);
+    return FALSE;
+  }
+
+  gst_rtsp_connection_set_auth (connection, method, url->user, url->passwd);
+  if (method != GST_RTSP_AUTH_DIGEST)
+    return TRUE;
+
+  gst_rtsp_connection_clear_auth_params (connection);
+  params = g_strsplit (header, ",", -1);
+  for (param = params; *param != NULL; param++) {
+    pair = g_strsplit (g_strstrip (*param), "=", 2);
+    if (pair[0] && pair[1]) {
+      /* values are usually quoted */
+      g_strstrip (pair[1]);
+      if (pair[1][0] == '"') {
+        memmove (pair[1], pair[1] + 1, strlen (pair[1]));
+        if (g_str_has_suffix (pair[1], "\""))
+          pair[1][strlen (pair[1]) - 1] = '\0';
+      }
+      gst_rtsp_connection_set_auth_param (connection, pair[0], pair[1]);
+    }
+    g_strfreev (pair);
+  }
+  g_strfreev (params);
+
+  return TRUE;
+}
+
+static GstRTSPResult
+send_describe (GstRTSPConnection *connection, const gchar *uri, guint cseq,
+    GstRTSPMessage *response, GTimeVal *timeout)
+{
+  GstRTSPMessage request = { 0 };
+  GstRTSPResult res;
+  gchar *cseq_str;
+
+  gst_rtsp_message_init_request (&request, GST_RTSP_DESCRIBE, uri);
+  cseq_str = g_strdup_printf ("%u", cseq);
+  gst_rtsp_message_add_header (&request, GST_RTSP_HDR_CSEQ, cseq_str);
+  g_free (cseq_str);
+  gst_rtsp_message_add_header (&request, GST_RTSP_HDR_ACCEPT,
+      "application/sdp");
+
+  res = gst_rtsp_connection_send (connection, &request, timeout);
+  if (res == GST_RTSP_OK)
+    res = gst_rtsp_connection_receive (connection, response, timeout);
+
+  gst_rtsp_message_unset (&request);
+
+  return res;
+}
+
+static guint
+do_describe_streams (GstRTSPRelayMediaFactory *factory, GstBin *bin,
+    GstElement *rtspsrc)
+{
+  GstRTSPUrl *url = NULL;
+  gchar *uri = NULL;
+  GstRTSPConnection *connection = NULL;
+  GstRTSPMessage response = { 0 };
+  GstRTSPResult res;
+  GstSDPMessage *sdp = NULL;
+  GTimeVal timeout;
+  gchar *auth;
+  guint8 *data;
+  guint size;
+  gint num_streams = 0;
+
+  GST_INFO_OBJECT (factory, "describing %s", factory->location);
+
+  GST_TIME_TO_TIMEVAL (factory->timeout, timeout);
+
+  if (gst_rtsp_url_parse (factory->location, &url) != GST_RTSP_OK) {
+    GST_ERROR_OBJECT (factory, "invalid location %s", factory->location);
+    goto out;
+  }
+
+  if (gst_rtsp_connection_create (url, &connection) != GST_RTSP_OK)
+    goto out;
+
+  res = gst_rtsp_connection_connect (connection, &timeout);
+  if (res != GST_RTSP_OK) {
+    GST_WARNING_OBJECT (factory, "couldn't connect: %d", res);
+    goto out;
+  }
+
+  /* the request line must not carry the credentials of the location */
+  uri = gst_rtsp_url_get_request_uri (url);
+
+  res = send_describe (connection, uri, 1, &response, &timeout);
+  if (res == GST_RTSP_OK && response.type == GST_RTSP_MESSAGE_RESPONSE &&
+      response.type_data.response.code == GST_RTSP_STS_UNAUTHORIZED) {
+    if (gst_rtsp_message_get_header (&response,
+            GST_RTSP_HDR_WWW_AUTHENTICATE, &auth, 0) == GST_RTSP_OK &&
+        setup_describe_auth (factory, connection, url, auth)) {
+      gst_rtsp_message_unset (&response);
+      res = send_describe (connection, uri, 2, &response, &timeout);
+    }
+  }
+
+  if (res != GST_RTSP_OK) {
+    GST_WARNING_OBJECT (factory, "DESCRIBE failed: %d", res);
+    goto out;
+  }
+
+  if (response.type != GST_RTSP_MESSAGE_RESPONSE ||
+      response.type_data.response.code != GST_RTSP_STS_OK) {
+    GST_WARNING_OBJECT (factory, "DESCRIBE returned %d",
+        response.type_data.response.code);
+    goto out;
+  }
+
+  gst_rtsp_message_get_body (&response, &data, &size);
+  gst_sdp_message_new (&sdp);
+  if (gst_sdp_message_parse_buffer (data, size, sdp) != GST_SDP_OK) {
+    GST_WARNING_OBJECT (factory, "couldn't parse sdp");
+    goto out;
+  }
+
+  g_mutex_lock (factory->lock);
+  num_streams = create_payloaders_from_sdp (factory, sdp, bin);
+  g_mutex_unlock (factory->lock);
+
+  if (num_streams != 0)
+    g_object_connect (G_OBJECT (rtspsrc),
+        "signal::pad-added", G_CALLBACK (rtspsrc_pad_added_cb_link_dynamic), factory,
+        NULL);
+
+out:
+  if (sdp)
+    gst_sdp_message_free (sdp);
+  gst_rtsp_message_unset (&response);
+  g_free (uri);
+  if (connection) {
+    gst_rtsp_connection_close (connection);
+    gst_rtsp_connection_free (connection);
+  }
+  if (url)
+    gst_rtsp_url_free (url);
+
+  return num_streams;
+}
+
+static gboolean
+parse_variant (const GstRTSPUrl *url, GstRTSPRelayVariant *variant,
+    guint *interval)
+{
+  gchar **params, **param;
+  const gchar *value = NULL;
+  gchar *end;
+  gboolean ret = TRUE;
+
+  *variant = GST_RTSP_RELAY_VARIANT_FULL;
+  *interval = 1;
+
+  if (url->query == NULL)
+    return TRUE;
+
+  params = g_strsplit (url->query, "&", -1);
+  for (param = params; *param != NULL; param++) {
+    if (g_str_has_prefix (*param, "variant="))
+      value = *param + strlen ("variant=");
+  }
+
+  if (value == NULL || *value == '\0')
+    goto out;
+
+  if (g_str_has_prefix (value, "keyframes")) {
+    *variant = GST_RTSP_RELAY_VARIANT_KEYFRAMES;
+    value += strlen ("keyframes");
+  } else if (g_str_has_prefix (value, "gop")) {
+    *variant = GST_RTSP_RELAY_VARIANT_GOP;
+    value += strlen ("gop");
+  } else {
+    ret = FALSE;
+    goto out;
+  }
+
+  /* optional :N, relay one out of every N keyframes or GOPs */
+  if (*value == ':') {
+    *interval = strtoul (value + 1, &end, 10);
+    ret = *interval != 0 && *end == '\0';
+  } else {
+    ret = *value == '\0';
+  }
+
+out:
+  if (!ret) {
+    *variant = GST_RTSP_RELAY_VARIANT_FULL;
+    *interval = 1;
+  }
+
+  g_strfreev (params);
+
+  return ret;
+}
+
+static GstElement *
+create_rtspsrc (GstRTSPRelayMediaFactory *factory, const gchar *location)
+{
+  GstElement *rtspsrc;
+
+  rtspsrc = gst_element_factory_create (rtspsrc_factory, NULL);
+  GST_INFO_OBJECT (factory, "setting latency %"GST_TIME_FORMAT,
+      GST_TIME_ARGS (factory->latency));
+  g_object_set (rtspsrc, "latency",
+      GST_TIME_AS_MSECONDS (factory->latency), "tcp-timeout", 3000000, NULL);
+  g_object_set (rtspsrc, "udp-buffer-size", factory->udp_buffer_size, NULL);
+  g_object_set (G_OBJECT (rtspsrc), "location", location, NULL);
+
+  return rtspsrc;
+}
+
 static GstElement *
 gst_rtsp_relay_media_factory_get_element (GstRTSPMediaFactory *media_factory,
     const GstRTSPUrl *url)
 {
   GstBin *bin;
-  GstElement *rtspsrc;
+  GstElement *rtspsrc, *standby;
   guint num_streams;
   GstRTSPRelayMediaFactory *factory = GST_RTSP_RELAY_MEDIA_FACTORY (media_factory);
 
   GST_INFO_OBJECT (factory, "creating element");
 
-  bin = GST_BIN (gst_bin_new (NULL));
-  rtspsrc = gst_element_factory_make ("rtspsrc", NULL);
-  GST_INFO_OBJECT (factory, "setting latency %"GST_TIME_FORMAT,
-      GST_TIME_ARGS (factory->latency));
-  g_object_set (rtspsrc, "latency",
-      GST_TIME_AS_MSECONDS (factory->latency), "tcp-timeout", 3000000, NULL);
-  g_object_set (G_OBJECT (rtspsrc), "location", factory->location, NULL);
-
-  gst_bin_add (bin, GST_ELEMENT (rtspsrc));
+  if (!parse_variant (url, &factory->variant, &factory->variant_interval))
+    GST_WARNING_OBJECT (factory, "invalid variant in query %s, relaying "
+        "the full stream", url->query);
+  if (!g_static_private_get (&variant_admitted)) {
+    factory->variant = GST_RTSP_RELAY_VARIANT_FULL;
+    factory->variant_interval = 1;
+  }
+  GST_INFO_OBJECT (factory, "variant %d interval %d",
+      factory->variant, factory->variant_interval);
 
-  if (factory->find_dynamic_streams)
-    num_streams = do_find_dynamic_streams (factory, bin, rtspsrc);
-  else
+  bin = GST_BIN (gst_bin_new (NULL));
+  g_object_set_data_full (G_OBJECT (bin), "relay::stats",
+      media_stats_new (), (GDestroyNotify) media_stats_free);
+  rtspsrc = create_rtspsrc (factory, factory->location);
+  /* hold a normal reference while the probes move it around */
+  gst_object_ref (rtspsrc);
+  gst_object_sink (rtspsrc);
+
+  if (factory->find_dynamic_streams) {
+    num_streams = 0;
+    if (factory->sdp_probe) {
+      num_streams = do_describe_streams (factory, bin, rtspsrc);
+      if (num_streams == 0)
+        GST_WARNING_OBJECT (factory, "sdp probe of %s failed, falling back "
+            "to playing it", factory->location);
+    }
+    if (num_streams == 0)
+      num_streams = do_find_dynamic_streams (factory, bin, rtspsrc);
+  } else
     g_assert_not_reached ();
 
   if (num_streams == 0) {
     GST_WARNING_OBJECT (factory, "no streams found");
 
+    gst_object_unref (rtspsrc);
     gst_object_unref (bin);
     return NULL;
   }
 
+  gst_bin_add (bin, rtspsrc);
+  gst_object_unref (rtspsrc);
+
+  if (factory->standby_location) {
+    /* the standby links to the selectors of the streams found on the
+     * primary */
+    standby = create_rtspsrc (factory, factory->standby_location);
+    g_object_set_data (G_OBJECT (standby), "relay::standby",
+        GINT_TO_POINTER (TRUE));
+    g_object_connect (G_OBJECT (standby),
+        "signal::pad-added", G_CALLBACK (rtspsrc_pad_added_cb_link_dynamic), factory,
+        NULL);
+    gst_bin_add (bin, standby);
+
+    g_timeout_add_full (G_PRIORITY_HIGH,
+        MAX (GST_TIME_AS_MSECONDS (factory->failover_timeout) / 2, 10),
+        (GSourceFunc) failover_watchdog_cb, gst_object_ref (bin),
+        (GDestroyNotify) gst_object_unref);
+  }
+
   GST_INFO_OBJECT (factory, "created bin %s, %d streams",
-      gst_object_get_name (GST_OBJECT (bin)), num_streams);
+      GST_OBJECT_NAME (bin), num_streams);
+
+  track_media (factory, bin);
 
   return GST_ELEMENT (bin);
 }
 
+typedef struct
+{
+  const gchar *key;
+  guint count;
+  gboolean found;
+} VariantCount;
+
+static void
+count_variant (const gchar *key, GstRTSPMedia *media, VariantCount *data)
+{
+  if (strstr (key, "?variant=") == NULL)
+    return;
+
+  data->count += 1;
+  if (!strcmp (key, data->key))
+    data->found = TRUE;
+}
+
+/* every variant is a media of its own with its own rtspsrc, so it pulls the
+ * upstream once more. Returns whether a media for key can be shared or one
+ * more variant fits in max-variants */
+static gboolean
+check_variant (GstRTSPRelayMediaFactory *factory, const gchar *key)
+{
+  GstRTSPMediaFactory *media_factory = GST_RTSP_MEDIA_FACTORY (factory);
+  VariantCount data = { key, 0, FALSE };
+
+  g_mutex_lock (media_factory->medias_lock);
+  g_hash_table_foreach (media_factory->medias, (GHFunc) count_variant, &data);
+  g_mutex_unlock (media_factory->medias_lock);
+
+  return data.found || data.count < factory->max_variants;
+}
+
+static gchar *
+gst_rtsp_relay_media_factory_gen_key (GstRTSPMediaFactory *factory,
+    const GstRTSPUrl *url)
+{
+  gchar *key, *variant_key;
+  GstRTSPRelayVariant variant;
+  guint interval;
+  guint clients;
+  guint64 bandwidth;
+  gboolean admitted;
+
+  key = GST_RTSP_MEDIA_FACTORY_CLASS
+      (gst_rtsp_relay_media_factory_parent_class)->gen_key (factory, url);
+  g_static_private_set (&variant_admitted, NULL, NULL);
+
+  /* no cached media for clients that don't fit, construct refuses them */
+  g_static_mutex_lock (&usage_lock);
+  update_global_usage_unlocked (&clients, &bandwidth);
+  admitted = check_admission_unlocked (GST_RTSP_RELAY_MEDIA_FACTORY (factory));
+  if (admitted)
+    add_pending_client_unlocked (GST_RTSP_RELAY_MEDIA_FACTORY (factory));
+  g_static_mutex_unlock (&usage_lock);
+
+  g_static_private_set (&client_admitted, GINT_TO_POINTER (admitted), NULL);
+  if (!admitted) {
+    g_free (key);
+    return NULL;
+  }
+
+  /* NULL when the factory isn't shared */
+  if (key == NULL)
+    return NULL;
+
+  /* the parent key ends with the query, which only selects the variant
+   * here. Key on the normalized variant so that equivalent queries share a
+   * media and a refused variant shares the full one. */
+  g_free (key);
+  key = g_strdup_printf ("%u%s", url->port, url->abspath);
+
+  parse_variant (url, &variant, &interval);
+  if (variant == GST_RTSP_RELAY_VARIANT_FULL)
+    return key;
+
+  variant_key = g_strdup_printf ("%s?variant=%d:%u", key, variant, interval);
+  if (!check_variant (GST_RTSP_RELAY_MEDIA_FACTORY (factory), variant_key)) {
+    GST_WARNING_OBJECT (factory, "too many variants, relaying the full "
+        "stream for %s", url->query);
+    g_free (variant_key);
+    return key;
+  }
+  g_static_private_set (&variant_admitted, GINT_TO_POINTER (TRUE), NULL);
+  g_free (key);
+
+  return variant_key;
+}
+
+static GstRTSPMedia *
+gst_rtsp_relay_media_factory_construct (GstRTSPMediaFactory *media_factory,
+    const GstRTSPUrl *url)
+{
+  /* gen_key decided for this request and already counts the client */
+  if (!g_static_private_get (&client_admitted))
+    return NULL;
+
+  return GST_RTSP_MEDIA_FACTORY_CLASS
+      (gst_rtsp_relay_media_factory_parent_class)->construct (media_factory, url);
+}
+
 static gpointer
 unprepare_thread (gpointer user_data)
 {
@@ -654,36 +2359,189 @@ unprepare_thread (gpointer user_data)
   gst_element_set_state (media->pipeline, GST_STATE_NULL);
   g_mutex_unlock (factory->medias_lock);
   gst_rtsp_media_unprepare (media);
+  g_object_unref (media);
+
+  return NULL;
+}
+
+/* returns the rtspsrc of the media that posted message or one of its
+ * children, NULL if it came from elsewhere */
+static GstObject *
+get_message_upstream (GstRTSPMedia *media, GstMessage *message)
+{
+  GstObject *object, *parent;
+
+  for (object = GST_MESSAGE_SRC (message); object != NULL; object = parent) {
+    parent = GST_OBJECT_PARENT (object);
+    if (parent == GST_OBJECT (media->element)) {
+      if (GST_IS_ELEMENT (object) &&
+          gst_element_get_factory (GST_ELEMENT (object)) == rtspsrc_factory)
+        return object;
+      break;
+    }
+  }
 
   return NULL;
 }
 
+/* an upstream of a media with a standby failed. Mark it stalled so that the
+ * watchdog doesn't switch to it, and switch away from it right away if the
+ * other upstream still flows. Returns FALSE if neither upstream is left. */
+static gboolean
+failover_upstream_failed (GstRTSPMedia *media, gboolean standby)
+{
+  GPtrArray *states;
+  FailoverState *state;
+  GstClockTime now, last_other;
+  GstPad *other;
+  gboolean other_alive = FALSE, active;
+  guint i;
+
+  states = g_object_get_data (G_OBJECT (media->element), "relay::failover");
+  if (states == NULL)
+    return FALSE;
+
+  now = gst_util_get_timestamp ();
+  for (i = 0; i < states->len; i++) {
+    state = g_ptr_array_index (states, i);
+
+    GST_OBJECT_LOCK (state->selector);
+    if (standby) {
+      state->last_standby = GST_CLOCK_TIME_NONE;
+      last_other = state->last_primary;
+      other = state->primary;
+    } else {
+      state->last_primary = GST_CLOCK_TIME_NONE;
+      last_other = state->last_standby;
+      other = state->standby;
+    }
+    active = state->on_standby == standby;
+    if (other && GST_CLOCK_TIME_IS_VALID (last_other) &&
+        now - last_other < state->timeout) {
+      other_alive = TRUE;
+      if (active)
+        state->on_standby = !standby;
+    } else {
+      other = NULL;
+    }
+    GST_OBJECT_UNLOCK (state->selector);
+
+    if (active && other)
+      g_object_set (state->selector, "active-pad", other, NULL);
+  }
+
+  return other_alive;
+}
+
 static void
 media_bus_warning_cb (GstBus *bus, GstMessage *message, gpointer user_data)
 {
   GstRTSPMedia *media = GST_RTSP_MEDIA (user_data);
   GstRTSPMediaFactory *factory = GST_RTSP_MEDIA_FACTORY (g_object_get_data (G_OBJECT (media), "relay::factory"));
+  GError *error = NULL;
+  gchar *debug = NULL;
+  GstObject *upstream;
+  gboolean fatal;
+
   switch (GST_MESSAGE_TYPE (message)) {
     case GST_MESSAGE_WARNING:
-    {
-      GError *error = NULL;
-      gchar *debug;
       gst_message_parse_warning (message, &error, &debug);
-      GST_WARNING_OBJECT (factory, "media %p warning: %s debug: %s",
-          media, error->message, debug);
-      if (error->domain == GST_RESOURCE_ERROR && error->code == GST_RESOURCE_ERROR_READ) {
-        g_mutex_lock (factory->medias_lock);
-        g_thread_create (unprepare_thread, media, FALSE, NULL);
-      }
+      fatal = error->domain == GST_RESOURCE_ERROR &&
+          error->code == GST_RESOURCE_ERROR_READ;
       break;
-    }
     case GST_MESSAGE_ERROR:
-        g_mutex_lock (factory->medias_lock);
-        g_thread_create (unprepare_thread, media, FALSE, NULL);
-        break;
-    default:
+      gst_message_parse_error (message, &error, &debug);
+      fatal = TRUE;
       break;
+    default:
+      return;
+  }
+
+  GST_WARNING_OBJECT (factory, "media %p %s from %s: %s debug: %s", media,
+      GST_MESSAGE_TYPE_NAME (message), GST_MESSAGE_SRC_NAME (message),
+      error->message, debug);
+  g_error_free (error);
+  g_free (debug);
+
+  if (!fatal)
+    return;
+
+  /* with a standby, losing one upstream is not fatal for the media. A
+   * failing standby never is, the primary keeps the media going. */
+  upstream = get_message_upstream (media, message);
+  if (upstream && g_object_get_data (G_OBJECT (media->element),
+          "relay::failover")) {
+    if (g_object_get_data (G_OBJECT (upstream), "relay::standby")) {
+      failover_upstream_failed (media, TRUE);
+      return;
+    }
+
+    if (failover_upstream_failed (media, FALSE)) {
+      GST_WARNING_OBJECT (factory, "media %p primary failed, relaying the "
+          "standby", media);
+      return;
+    }
+  }
+
+  /* one failure can post a warning and errors, tear the media down once */
+  g_mutex_lock (factory->medias_lock);
+  if (g_object_get_data (G_OBJECT (media), "relay::unpreparing")) {
+    g_mutex_unlock (factory->medias_lock);
+    return;
+  }
+  g_object_set_data (G_OBJECT (media), "relay::unpreparing",
+      GINT_TO_POINTER (TRUE));
+  g_thread_create (unprepare_thread, g_object_ref (media), FALSE, NULL);
+}
+
+static void
+media_bus_stream_status_cb (GstBus *bus, GstMessage *message, gpointer user_data)
+{
+  GstRTSPMedia *media = GST_RTSP_MEDIA (user_data);
+  GstRTSPRelayMediaFactory *factory = GST_RTSP_RELAY_MEDIA_FACTORY (g_object_get_data (G_OBJECT (media), "relay::factory"));
+  GstStreamStatusType type;
+  GstElement *owner;
+  const GValue *value;
+  GstTask *task;
+
+  gst_message_parse_stream_status (message, &type, &owner);
+  if (type != GST_STREAM_STATUS_TYPE_CREATE || factory->task_pool == NULL)
+    return;
+
+  value = gst_message_get_stream_status_object (message);
+  if (value == NULL || !G_VALUE_HOLDS_OBJECT (value))
+    return;
+
+  task = GST_TASK (g_value_get_object (value));
+  GST_DEBUG_OBJECT (factory, "media %p running %s task on pool %s", media,
+      GST_ELEMENT_NAME (owner), GST_OBJECT_NAME (factory->task_pool));
+  gst_task_set_pool (task, factory->task_pool);
+}
+
+static void
+media_unprepared_cb (GstRTSPMedia *media, gpointer user_data)
+{
+  GstRTSPRelayMediaFactory *factory = GST_RTSP_RELAY_MEDIA_FACTORY (g_object_get_data (G_OBJECT (media), "relay::factory"));
+  GstBin *bin = GST_BIN (media->element);
+  GList *payloaders = NULL, *walk;
+  GstElement *payloader;
+
+  GST_OBJECT_LOCK (bin);
+  for (walk = GST_BIN_CHILDREN (bin); walk != NULL; walk = walk->next) {
+    if (g_object_get_data (G_OBJECT (walk->data), "relay::description"))
+      payloaders = g_list_prepend (payloaders, gst_object_ref (walk->data));
+  }
+  GST_OBJECT_UNLOCK (bin);
+
+  /* the media isn't reusable, give its payloaders to the next one */
+  for (walk = payloaders; walk != NULL; walk = walk->next) {
+    payloader = GST_ELEMENT (walk->data);
+
+    gst_bin_remove (bin, payloader);
+    gst_element_set_state (payloader, GST_STATE_NULL);
+    payloader_pool_checkin (factory, payloader);
   }
+  g_list_free (payloaders);
 }
 
 static void
@@ -697,8 +2555,14 @@ gst_rtsp_relay_media_factory_configure (GstRTSPMediaFactory * factory, GstRTSPMe
   bus = gst_pipeline_get_bus (GST_PIPELINE (media->pipeline));
   gst_bus_set_sync_handler (bus, gst_bus_sync_signal_handler, factory);
   g_object_connect (bus, "signal::sync-message::warning",
-      G_CALLBACK (media_bus_warning_cb), media, NULL);
+      G_CALLBACK (media_bus_warning_cb), media,
+      "signal::sync-message::error",
+      G_CALLBACK (media_bus_warning_cb), media,
+      "signal::sync-message::stream-status",
+      G_CALLBACK (media_bus_stream_status_cb), media, NULL);
   gst_object_unref (bus);
 
   g_object_set_data (G_OBJECT (media), "relay::factory", factory);
+  g_signal_connect (media, "unprepared", G_CALLBACK (media_unprepared_cb),
+      NULL);
 }
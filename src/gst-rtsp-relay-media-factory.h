@@ -35,6 +35,22 @@ G_BEGIN_DECLS
 #define GST_RTSP_RELAY_MEDIA_FACTORY_CAST(obj)         ((GstRTSPRelayMediaFactory*)(obj))
 #define GST_RTSP_RELAY_MEDIA_FACTORY_CLASS_CAST(klass) ((GstRTSPRelayMediaFactoryClass*)(klass))
 
+/**
+ * GstRTSPRelayVariant:
+ * @GST_RTSP_RELAY_VARIANT_FULL: relay the upstream as is
+ * @GST_RTSP_RELAY_VARIANT_KEYFRAMES: relay only every Nth video keyframe
+ * @GST_RTSP_RELAY_VARIANT_GOP: relay only every Nth video GOP
+ *
+ * Derived streams a client can request with a variant=keyframes[:N] or
+ * variant=gop[:N] query parameter on the mount url. Each variant is relayed
+ * by a media of its own pulling the upstream again, see max-variants.
+ */
+typedef enum {
+  GST_RTSP_RELAY_VARIANT_FULL,
+  GST_RTSP_RELAY_VARIANT_KEYFRAMES,
+  GST_RTSP_RELAY_VARIANT_GOP
+} GstRTSPRelayVariant;
+
 typedef struct _GstRTSPRelayMediaFactory GstRTSPRelayMediaFactory;
 typedef struct _GstRTSPRelayMediaFactoryClass GstRTSPRelayMediaFactoryClass;
 
@@ -43,14 +59,55 @@ struct _GstRTSPRelayMediaFactory {
 
   GMutex *lock;
   gboolean find_dynamic_streams;
+  gboolean sdp_probe;
   GstClockTime latency;
   GstClockTime timeout;
+  gint udp_buffer_size;
   char *location;
+  char *standby_location;
+  GstClockTime failover_timeout;
   gboolean rtspsrc_no_more_pads;
   GCond *dynamic_pads_cond;
+  /* payloaders of the media being built, moved to its bin */
   GList *dynamic_payloaders;
   gint pads_waiting_block;
   gboolean error;
+  GstRTSPRelayVariant variant;
+  guint variant_interval;
+  guint max_variants;
+
+  /* payloader bins recycled from unprepared medias, queued by description */
+  GMutex *payloader_pool_lock;
+  GHashTable *payloader_pool;
+  guint prewarm_payloaders;
+
+  /* admission control, 0 means unlimited */
+  guint max_clients;
+  guint64 max_bandwidth;
+  /* bitrate assumed for a media until it has been measured */
+  guint64 bitrate_estimate;
+  /* last usage sample, protected by the global usage lock */
+  guint clients;
+  guint64 bandwidth;
+  guint64 media_bitrate;
+  /* admission times of clients that aren't playing yet, and the playing
+   * clients of the last sample */
+  GArray *pending;
+  guint playing;
+
+  /* runs the streaming threads of the medias, NULL for the default pool */
+  GstTaskPool *task_pool;
+
+  /* live medias and elements created for them, updated atomically */
+  gint medias;
+  gint objects;
+  gint object_bytes;
+
+  /* RTP packets of location and of standby-location, protected by
+   * packets_lock */
+  GMutex *packets_lock;
+  guint64 packets_received[2];
+  guint64 packets_lost[2];
 };
 
 struct _GstRTSPRelayMediaFactoryClass {
@@ -62,6 +119,12 @@ GType gst_rtsp_relay_media_factory_get_type (void);
 /* creating the factory */
 GstRTSPRelayMediaFactory * gst_rtsp_relay_media_factory_new (const char *url);
 
+/* limits and usage summed over all the relay factories */
+void gst_rtsp_relay_media_factory_set_global_limits (guint max_clients,
+    guint64 max_bandwidth);
+void gst_rtsp_relay_media_factory_get_global_usage (guint *clients,
+    guint64 *bandwidth);
+
 G_END_DECLS
 
 #endif /* __GST_RTSP_RELAY_MEDIA_FACTORY_H__ */
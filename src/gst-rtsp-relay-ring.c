@@ -0,0 +1,132 @@
+/* GStreamer
+ * Copyright (C) 2010 Alessandro Decina <alessandro.d@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#include <stdlib.h>
+
+#include "gst-rtsp-relay-ring.h"
+
+typedef struct
+{
+  guint32 hash;
+  guint node;
+} RingPoint;
+
+struct _GstRTSPRelayRing
+{
+  gchar **nodes;
+  RingPoint *points;
+  guint n_points;
+};
+
+/* FNV-1a, unlike g_str_hash it's stable across glib versions so every node
+ * of the cluster computes the same placement */
+static guint32
+ring_hash (const gchar *key)
+{
+  guint32 hash = 2166136261U;
+
+  for (; *key != '\0'; key++) {
+    hash ^= (guint8) *key;
+    hash *= 16777619U;
+  }
+
+  return hash;
+}
+
+static int
+ring_point_compare (const void *a, const void *b)
+{
+  const RingPoint *pa = a, *pb = b;
+
+  if (pa->hash != pb->hash)
+    return pa->hash < pb->hash ? -1 : 1;
+
+  return (int) pa->node - (int) pb->node;
+}
+
+GstRTSPRelayRing *
+gst_rtsp_relay_ring_new (gchar **nodes, guint replicas)
+{
+  GstRTSPRelayRing *ring;
+  guint i, r, n_nodes;
+  gchar *key;
+
+  g_return_val_if_fail (nodes != NULL && nodes[0] != NULL, NULL);
+  g_return_val_if_fail (replicas > 0, NULL);
+
+  n_nodes = g_strv_length (nodes);
+
+  ring = g_new0 (GstRTSPRelayRing, 1);
+  ring->nodes = g_strdupv (nodes);
+  ring->n_points = n_nodes * replicas;
+  ring->points = g_new (RingPoint, ring->n_points);
+
+  /* place replicas points per node so mounts spread evenly and only the
+   * mounts of a node move when it joins or leaves */
+  for (i = 0; i < n_nodes; i++) {
+    for (r = 0; r < replicas; r++) {
+      key = g_strdup_printf ("%s#%u", nodes[i], r);
+      ring->points[i * replicas + r].hash = ring_hash (key);
+      ring->points[i * replicas + r].node = i;
+      g_free (key);
+    }
+  }
+
+  qsort (ring->points, ring->n_points, sizeof (RingPoint), ring_point_compare);
+
+  return ring;
+}
+
+void
+gst_rtsp_relay_ring_free (GstRTSPRelayRing *ring)
+{
+  g_return_if_fail (ring != NULL);
+
+  g_strfreev (ring->nodes);
+  g_free (ring->points);
+  g_free (ring);
+}
+
+const gchar *
+gst_rtsp_relay_ring_get_node (GstRTSPRelayRing *ring, const gchar *key)
+{
+  guint32 hash;
+  guint low, high, mid;
+
+  g_return_val_if_fail (ring != NULL, NULL);
+  g_return_val_if_fail (key != NULL, NULL);
+
+  hash = ring_hash (key);
+
+  /* first point at or after hash, wrapping around */
+  low = 0;
+  high = ring->n_points;
+  while (low < high) {
+    mid = low + (high - low) / 2;
+    if (ring->points[mid].hash < hash)
+      low = mid + 1;
+    else
+      high = mid;
+  }
+
+  if (low == ring->n_points)
+    low = 0;
+
+  return ring->nodes[ring->points[low].node];
+}
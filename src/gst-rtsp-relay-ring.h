@@ -0,0 +1,38 @@
+/* GStreamer
+ * Copyright (C) 2010 Alessandro Decina <alessandro.d@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#include <glib.h>
+
+#ifndef __GST_RTSP_RELAY_RING_H__
+#define __GST_RTSP_RELAY_RING_H__
+
+G_BEGIN_DECLS
+
+/* consistent hash ring placing mounts on the relay nodes of a cluster */
+typedef struct _GstRTSPRelayRing GstRTSPRelayRing;
+
+GstRTSPRelayRing * gst_rtsp_relay_ring_new (gchar **nodes, guint replicas);
+void gst_rtsp_relay_ring_free (GstRTSPRelayRing *ring);
+
+const gchar * gst_rtsp_relay_ring_get_node (GstRTSPRelayRing *ring,
+    const gchar *key);
+
+G_END_DECLS
+
+#endif /* __GST_RTSP_RELAY_RING_H__ */
@@ -0,0 +1,277 @@
+/* GStreamer
+ * Copyright (C) 2010 Alessandro Decina <alessandro.d@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#define _GNU_SOURCE
+#include <stdlib.h>
+#ifdef HAVE_PTHREAD_SETAFFINITY_NP
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+#include "gst-rtsp-relay-task-pool.h"
+
+#define DEFAULT_CPUS NULL
+
+enum
+{
+  PROP_0,
+  PROP_CPUS,
+};
+
+typedef struct
+{
+  GstTaskPoolFunction func;
+  gpointer user_data;
+} TaskData;
+
+GST_DEBUG_CATEGORY_STATIC (rtsp_relay_task_pool_debug);
+#define GST_CAT_DEFAULT rtsp_relay_task_pool_debug
+
+static void gst_rtsp_relay_task_pool_get_property (GObject *object, guint propid,
+    GValue *value, GParamSpec *pspec);
+static void gst_rtsp_relay_task_pool_set_property (GObject *object, guint propid,
+    const GValue *value, GParamSpec *pspec);
+static void gst_rtsp_relay_task_pool_finalize (GObject * obj);
+static void gst_rtsp_relay_task_pool_prepare (GstTaskPool *pool, GError **error);
+static gpointer gst_rtsp_relay_task_pool_push (GstTaskPool *pool,
+    GstTaskPoolFunction func, gpointer user_data, GError **error);
+
+G_DEFINE_TYPE (GstRTSPRelayTaskPool, gst_rtsp_relay_task_pool, GST_TYPE_TASK_POOL);
+
+static void
+gst_rtsp_relay_task_pool_class_init (GstRTSPRelayTaskPoolClass * klass)
+{
+  GObjectClass *gobject_class;
+  GstTaskPoolClass *task_pool_class = GST_TASK_POOL_CLASS (klass);
+
+  gobject_class = G_OBJECT_CLASS (klass);
+
+  gobject_class->get_property = gst_rtsp_relay_task_pool_get_property;
+  gobject_class->set_property = gst_rtsp_relay_task_pool_set_property;
+  gobject_class->finalize = gst_rtsp_relay_task_pool_finalize;
+
+  task_pool_class->prepare = gst_rtsp_relay_task_pool_prepare;
+  task_pool_class->push = gst_rtsp_relay_task_pool_push;
+
+  g_object_class_install_property (gobject_class, PROP_CPUS,
+      g_param_spec_string ("cpus", "Cpus",
+          "cpus the threads run on, like 0,2-3. NULL for all the cpus",
+          DEFAULT_CPUS, G_PARAM_READWRITE | G_PARAM_CONSTRUCT_ONLY));
+
+  GST_DEBUG_CATEGORY_INIT (rtsp_relay_task_pool_debug,
+      "rtsprelaytaskpool", 0, "RTSP Relay Task Pool");
+}
+
+static void
+gst_rtsp_relay_task_pool_init (GstRTSPRelayTaskPool * pool)
+{
+  pool->cpus = NULL;
+  pool->cpu_array = g_array_new (FALSE, FALSE, sizeof (guint));
+}
+
+static void
+gst_rtsp_relay_task_pool_finalize (GObject * obj)
+{
+  GstRTSPRelayTaskPool *pool = GST_RTSP_RELAY_TASK_POOL (obj);
+
+  g_free (pool->cpus);
+  g_array_free (pool->cpu_array, TRUE);
+
+  G_OBJECT_CLASS (gst_rtsp_relay_task_pool_parent_class)->finalize (obj);
+}
+
+static gboolean
+parse_cpus (const gchar *cpus, GArray *cpu_array)
+{
+  gchar **ranges, **range;
+  gchar *end;
+  guint first, last, cpu;
+  gboolean ret = TRUE;
+
+  ranges = g_strsplit (cpus, ",", -1);
+  for (range = ranges; *range != NULL && ret; range++) {
+    first = strtoul (*range, &end, 10);
+    last = first;
+    if (end == *range)
+      ret = FALSE;
+    else if (*end == '-')
+      last = strtoul (end + 1, &end, 10);
+
+    if (*end != '\0' || last < first)
+      ret = FALSE;
+
+    for (cpu = first; ret && cpu <= last; cpu++)
+      g_array_append_val (cpu_array, cpu);
+  }
+  g_strfreev (ranges);
+
+  return ret;
+}
+
+static void
+gst_rtsp_relay_task_pool_get_property (GObject *object, guint propid,
+    GValue *value, GParamSpec *pspec)
+{
+  GstRTSPRelayTaskPool *pool = GST_RTSP_RELAY_TASK_POOL (object);
+
+  switch (propid) {
+    case PROP_CPUS:
+      g_value_set_string (value, pool->cpus);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, propid, pspec);
+  }
+}
+
+static void
+gst_rtsp_relay_task_pool_set_property (GObject *object, guint propid,
+    const GValue *value, GParamSpec *pspec)
+{
+  GstRTSPRelayTaskPool *pool = GST_RTSP_RELAY_TASK_POOL (object);
+
+  switch (propid) {
+    case PROP_CPUS:
+      g_free (pool->cpus);
+      pool->cpus = g_value_dup_string (value);
+      g_array_set_size (pool->cpu_array, 0);
+      if (pool->cpus && !parse_cpus (pool->cpus, pool->cpu_array)) {
+        GST_WARNING_OBJECT (pool, "invalid cpus %s, not pinning", pool->cpus);
+        g_array_set_size (pool->cpu_array, 0);
+      }
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, propid, pspec);
+  }
+}
+
+GstRTSPRelayTaskPool *
+gst_rtsp_relay_task_pool_new (const gchar *cpus)
+{
+  GstRTSPRelayTaskPool *pool;
+
+  pool = g_object_new (GST_TYPE_RTSP_RELAY_TASK_POOL, "cpus", cpus, NULL);
+
+  return pool;
+}
+
+/* pins the current thread to the cpus of the pool, saving its previous
+ * affinity in saved. Returns FALSE if the thread wasn't pinned. */
+static gboolean
+pin_current_thread (GstRTSPRelayTaskPool *pool, gpointer saved)
+{
+#ifdef HAVE_PTHREAD_SETAFFINITY_NP
+  cpu_set_t cpuset;
+  guint i;
+  int res;
+
+  if (pool->cpu_array->len == 0)
+    return FALSE;
+
+  res = pthread_getaffinity_np (pthread_self (), sizeof (cpu_set_t), saved);
+  if (res != 0) {
+    GST_WARNING_OBJECT (pool, "couldn't get thread affinity: %d", res);
+    return FALSE;
+  }
+
+  CPU_ZERO (&cpuset);
+  for (i = 0; i < pool->cpu_array->len; i++)
+    CPU_SET (g_array_index (pool->cpu_array, guint, i), &cpuset);
+
+  res = pthread_setaffinity_np (pthread_self (), sizeof (cpuset), &cpuset);
+  if (res != 0) {
+    GST_WARNING_OBJECT (pool, "couldn't pin thread to cpus %s: %d",
+        pool->cpus, res);
+    return FALSE;
+  }
+
+  return TRUE;
+#else
+  return FALSE;
+#endif
+}
+
+static void
+unpin_current_thread (GstRTSPRelayTaskPool *pool, gpointer saved)
+{
+#ifdef HAVE_PTHREAD_SETAFFINITY_NP
+  int res;
+
+  res = pthread_setaffinity_np (pthread_self (), sizeof (cpu_set_t), saved);
+  if (res != 0)
+    GST_WARNING_OBJECT (pool, "couldn't restore thread affinity: %d", res);
+#endif
+}
+
+static void
+pinned_thread_func (TaskData *tdata, GstRTSPRelayTaskPool *pool)
+{
+#ifdef HAVE_PTHREAD_SETAFFINITY_NP
+  cpu_set_t saved;
+#else
+  gpointer saved = NULL;
+#endif
+  gboolean pinned;
+
+  /* the pool is not exclusive, so the thread comes from and goes back to
+   * the idle threads GLib shares between all the pools. Pin it for the
+   * task only and give it back with the affinity it had. */
+  pinned = pin_current_thread (pool, &saved);
+
+  tdata->func (tdata->user_data);
+  g_slice_free (TaskData, tdata);
+
+  if (pinned)
+    unpin_current_thread (pool, &saved);
+}
+
+static void
+gst_rtsp_relay_task_pool_prepare (GstTaskPool *pool, GError **error)
+{
+  GST_OBJECT_LOCK (pool);
+  pool->pool = g_thread_pool_new ((GFunc) pinned_thread_func, pool, -1,
+      FALSE, error);
+  GST_OBJECT_UNLOCK (pool);
+}
+
+static gpointer
+gst_rtsp_relay_task_pool_push (GstTaskPool *pool, GstTaskPoolFunction func,
+    gpointer user_data, GError **error)
+{
+  TaskData *tdata;
+
+  tdata = g_slice_new (TaskData);
+  tdata->func = func;
+  tdata->user_data = user_data;
+
+  GST_OBJECT_LOCK (pool);
+  if (pool->pool)
+    g_thread_pool_push (pool->pool, tdata, error);
+  else {
+    g_slice_free (TaskData, tdata);
+    g_set_error (error, GST_CORE_ERROR, GST_CORE_ERROR_FAILED,
+        "task pool is not prepared");
+  }
+  GST_OBJECT_UNLOCK (pool);
+
+  return NULL;
+}
@@ -0,0 +1,58 @@
+/* GStreamer
+ * Copyright (C) 2010 Alessandro Decina <alessandro.d@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#include <gst/gst.h>
+
+#ifndef __GST_RTSP_RELAY_TASK_POOL_H__
+#define __GST_RTSP_RELAY_TASK_POOL_H__
+
+G_BEGIN_DECLS
+
+#define GST_TYPE_RTSP_RELAY_TASK_POOL              (gst_rtsp_relay_task_pool_get_type ())
+#define GST_IS_RTSP_RELAY_TASK_POOL(obj)           (G_TYPE_CHECK_INSTANCE_TYPE ((obj), GST_TYPE_RTSP_RELAY_TASK_POOL))
+#define GST_IS_RTSP_RELAY_TASK_POOL_CLASS(klass)   (G_TYPE_CHECK_CLASS_TYPE ((klass), GST_TYPE_RTSP_RELAY_TASK_POOL))
+#define GST_RTSP_RELAY_TASK_POOL_GET_CLASS(obj)    (G_TYPE_INSTANCE_GET_CLASS ((obj), GST_TYPE_RTSP_RELAY_TASK_POOL, GstRTSPRelayTaskPoolClass))
+#define GST_RTSP_RELAY_TASK_POOL(obj)              (G_TYPE_CHECK_INSTANCE_CAST ((obj), GST_TYPE_RTSP_RELAY_TASK_POOL, GstRTSPRelayTaskPool))
+#define GST_RTSP_RELAY_TASK_POOL_CLASS(klass)      (G_TYPE_CHECK_CLASS_CAST ((klass), GST_TYPE_RTSP_RELAY_TASK_POOL, GstRTSPRelayTaskPoolClass))
+#define GST_RTSP_RELAY_TASK_POOL_CAST(obj)         ((GstRTSPRelayTaskPool*)(obj))
+#define GST_RTSP_RELAY_TASK_POOL_CLASS_CAST(klass) ((GstRTSPRelayTaskPoolClass*)(klass))
+
+typedef struct _GstRTSPRelayTaskPool GstRTSPRelayTaskPool;
+typedef struct _GstRTSPRelayTaskPoolClass GstRTSPRelayTaskPoolClass;
+
+/* a task pool whose threads only run on a fixed set of cpus */
+struct _GstRTSPRelayTaskPool {
+  GstTaskPool pool;
+
+  gchar *cpus;
+  GArray *cpu_array;
+};
+
+struct _GstRTSPRelayTaskPoolClass {
+  GstTaskPoolClass klass;
+};
+
+GType gst_rtsp_relay_task_pool_get_type (void);
+
+/* cpus is a list of cpus and ranges, like 0,2-3 */
+GstRTSPRelayTaskPool * gst_rtsp_relay_task_pool_new (const gchar *cpus);
+
+G_END_DECLS
+
+#endif /* __GST_RTSP_RELAY_TASK_POOL_H__ */
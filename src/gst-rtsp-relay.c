@@ -8,38 +8,154 @@
  * Author: Alessandro Decina <alessandro.d@gmail.com>
  */
 
+#include <string.h>
 #include <gst/gst.h>
 #include <gst/rtsp-server/rtsp-server.h>
 
 #include "gst-rtsp-relay-media-factory.h"
+#include "gst-rtsp-relay-task-pool.h"
+#include "gst-rtsp-relay-ring.h"
+
+#define RING_REPLICAS 160
+
+static gint max_clients = 0;
+static gint max_total_clients = 0;
+static gint64 max_bandwidth = 0;
+static gint64 max_total_bandwidth = 0;
+static gint64 bitrate_estimate = 0;
+static gchar *cpu_shards = NULL;
+static gchar *cluster_nodes = NULL;
+static gchar *cluster_node = NULL;
+static gchar *standby_url = NULL;
+static gint udp_buffer_size = 0;
+
+static GOptionEntry entries[] = {
+  { "max-clients", 0, 0, G_OPTION_ARG_INT, &max_clients,
+    "Maximum number of clients of the mount (0 = unlimited)", "N" },
+  { "max-total-clients", 0, 0, G_OPTION_ARG_INT, &max_total_clients,
+    "Maximum number of clients of the relay (0 = unlimited)", "N" },
+  { "max-bandwidth", 0, 0, G_OPTION_ARG_INT64, &max_bandwidth,
+    "Maximum egress of the mount in bits/s (0 = unlimited)", "BITRATE" },
+  { "max-total-bandwidth", 0, 0, G_OPTION_ARG_INT64, &max_total_bandwidth,
+    "Maximum egress of the relay in bits/s (0 = unlimited)", "BITRATE" },
+  { "bitrate-estimate", 0, 0, G_OPTION_ARG_INT64, &bitrate_estimate,
+    "Bitrate of a mount assumed by the bandwidth limits until it has been "
+    "measured (0 = 2 Mbit/s)", "BITRATE" },
+  { "cpu-shards", 0, 0, G_OPTION_ARG_STRING, &cpu_shards,
+    "Run streaming threads on pinned pools, mounts are hashed to one of "
+    "the ;-separated cpu lists", "0-1;2-3" },
+  { "udp-buffer-size", 0, 0, G_OPTION_ARG_INT, &udp_buffer_size,
+    "Receive buffer size of the upstream UDP sockets (0 = default)", "BYTES" },
+  { "standby", 0, 0, G_OPTION_ARG_STRING, &standby_url,
+    "Upstream publishing the same streams as REMOTE_URL, kept playing and "
+    "switched to when REMOTE_URL stalls. Not used by the PATH mounts", "URL" },
+  { "nodes", 0, 0, G_OPTION_ARG_STRING, &cluster_nodes,
+    "Run as an edge of a cluster of relays serving the same mounts. Mounts "
+    "owned by another node are relayed from that node", "rtsp://host:port,..." },
+  { "node", 0, 0, G_OPTION_ARG_STRING, &cluster_node,
+    "This node as listed in --nodes (default: rtsp://host:port of "
+    "LOCAL_URL)", "rtsp://host:port" },
+  { NULL }
+};
 
 static gboolean
 timeout (GstRTSPServer *server, gboolean ignored)
 {
   GstRTSPSessionPool *pool;
+  guint clients;
+  guint64 bandwidth;
 
   pool = gst_rtsp_server_get_session_pool (server);
   gst_rtsp_session_pool_cleanup (pool);
   g_object_unref (pool);
 
+  gst_rtsp_relay_media_factory_get_global_usage (&clients, &bandwidth);
+  g_print ("clients %u/%d bandwidth %" G_GUINT64_FORMAT "/%" G_GINT64_FORMAT
+      " bit/s\n", clients, max_total_clients, bandwidth, max_total_bandwidth);
+
   return TRUE;
 }
 
+/* relays remote_url on path. In a cluster remote_url is the mount on the
+ * origin: every node serves every mount, but only the node owning the mount
+ * pulls it from the origin and the other nodes pull it from the same path on
+ * the owner, so the origin serves each mount once to the whole cluster. */
+static void
+add_mount (GstRTSPMediaMapping *mapping, const gchar *path,
+    const gchar *origin_url, const gchar *standby, GstRTSPRelayRing *ring,
+    const gchar *node, GstTaskPool **pools, guint n_pools)
+{
+  GstRTSPRelayMediaFactory *factory;
+  gchar *remote_url;
+  const gchar *owner;
+
+  remote_url = g_strdup (origin_url);
+  if (ring) {
+    owner = gst_rtsp_relay_ring_get_node (ring, path);
+    if (strcmp (owner, node) != 0) {
+      g_free (remote_url);
+      remote_url = g_strdup_printf ("%s%s", owner, path);
+    }
+    g_print ("%s owned by %s, relaying %s\n", path, owner, remote_url);
+  }
+
+  factory = gst_rtsp_relay_media_factory_new (remote_url);
+  g_free (remote_url);
+  g_object_set (factory, "timeout", 20 * GST_SECOND, NULL);
+  g_object_set (factory, "latency", 300 * GST_MSECOND, NULL);
+  g_object_set (factory, "sdp-probe", TRUE, NULL);
+  g_object_set (factory, "prewarm-payloaders", 1, NULL);
+  g_object_set (factory, "standby-location", standby, NULL);
+  if (udp_buffer_size > 0)
+    g_object_set (factory, "udp-buffer-size", udp_buffer_size, NULL);
+  g_object_set (factory, "max-clients", max_clients,
+      "max-bandwidth", (guint64) max_bandwidth, NULL);
+  if (bitrate_estimate > 0)
+    g_object_set (factory, "bitrate-estimate", (guint64) bitrate_estimate,
+        NULL);
+
+  /* mounts are hashed to the shards so that a mount always runs on the same
+   * cpus */
+  if (n_pools)
+    g_object_set (factory, "task-pool", pools[g_str_hash (path) % n_pools],
+        NULL);
+
+  gst_rtsp_media_factory_set_shared (GST_RTSP_MEDIA_FACTORY (factory), TRUE);
+  gst_rtsp_media_mapping_add_factory (mapping, path,
+      GST_RTSP_MEDIA_FACTORY (factory));
+}
+
 int
 main(int argc, char **argv)
 {
   GMainLoop *loop;
   GstRTSPServer *server;
   GstRTSPMediaMapping *mapping;
-  GstRTSPRelayMediaFactory *factory;
-  gchar *name;
   GstRTSPUrl *local_url; 
   gchar *service;
+  GstRTSPRelayRing *ring = NULL;
+  GstTaskPool **pools = NULL;
+  guint n_pools = 0, i;
+  GOptionContext *context;
+  GError *error = NULL;
+
+  context = g_option_context_new ("LOCAL_URL REMOTE_URL [PATH REMOTE_URL...]");
+  g_option_context_set_summary (context, "Relays REMOTE_URL on LOCAL_URL. "
+      "More mounts can be served on the port of LOCAL_URL as PATH "
+      "REMOTE_URL pairs.");
+  g_option_context_add_main_entries (context, entries, NULL);
+  g_option_context_add_group (context, gst_init_get_option_group ());
+  if (!g_option_context_parse (context, &argc, &argv, &error)) {
+    g_printerr ("%s\n", error->message);
+    g_error_free (error);
 
-  gst_init (&argc, &argv);
+    return 1;
+  }
+  g_option_context_free (context);
 
-  if (argc != 3) {
-    g_printerr ("Usage: %s [LOCAL_URL] [REMOTE_URL]\n", argv[0]);
+  if (argc < 3 || argc % 2 != 1) {
+    g_printerr ("Usage: %s [OPTION...] LOCAL_URL REMOTE_URL "
+        "[PATH REMOTE_URL...]\n", argv[0]);
 
     return 1;
   }
@@ -57,18 +173,67 @@ main(int argc, char **argv)
   gst_rtsp_server_set_service (server, service);
   g_free (service);
 
-  name = g_strdup_printf ("rtsp-relay-factory-%s", argv[2]);
-  factory = gst_rtsp_relay_media_factory_new (argv[2]);
-  g_object_set (factory, "timeout", 20 * GST_SECOND, NULL);
-  g_object_set (factory, "latency", 300 * GST_MSECOND, NULL);
-  g_free (name);
+  if (cluster_nodes && *cluster_nodes) {
+    gchar **nodes;
+
+    if (cluster_node == NULL)
+      cluster_node = g_strdup_printf ("rtsp://%s:%d", local_url->host,
+          local_url->port);
+
+    nodes = g_strsplit (cluster_nodes, ",", -1);
+    /* a node missing from the list would relay the mounts it is assigned
+     * from itself, and nobody would pull them from the origin */
+    for (i = 0; nodes[i] != NULL; i++) {
+      if (strcmp (nodes[i], cluster_node) == 0)
+        break;
+    }
+    if (nodes[i] == NULL) {
+      g_printerr ("%s is not in --nodes, pass it as listed there with "
+          "--node\n", cluster_node);
+
+      return 1;
+    }
+
+    ring = gst_rtsp_relay_ring_new (nodes, RING_REPLICAS);
+    g_strfreev (nodes);
+  }
+
+  if (cpu_shards && *cpu_shards) {
+    gchar **shards;
+
+    shards = g_strsplit (cpu_shards, ";", -1);
+    n_pools = g_strv_length (shards);
+    pools = g_new0 (GstTaskPool *, n_pools);
+    for (i = 0; i < n_pools; i++) {
+      pools[i] = GST_TASK_POOL (gst_rtsp_relay_task_pool_new (shards[i]));
+      gst_task_pool_prepare (pools[i], &error);
+      if (error) {
+        g_printerr ("couldn't prepare task pool: %s\n", error->message);
+
+        return 1;
+      }
+    }
+    g_strfreev (shards);
+  }
+
+  gst_rtsp_relay_media_factory_set_global_limits (max_total_clients,
+      max_total_bandwidth);
 
-  gst_rtsp_media_factory_set_shared (GST_RTSP_MEDIA_FACTORY (factory), TRUE);
   mapping = gst_rtsp_server_get_media_mapping (server);
-  gst_rtsp_media_mapping_add_factory (mapping, local_url->abspath,
-      GST_RTSP_MEDIA_FACTORY (factory));
+  add_mount (mapping, local_url->abspath, argv[2], standby_url, ring,
+      cluster_node, pools, n_pools);
+  for (i = 3; i + 1 < argc; i += 2)
+    add_mount (mapping, argv[i], argv[i + 1], NULL, ring, cluster_node,
+        pools, n_pools);
   g_object_unref (mapping);
 
+  /* the factories hold the pools they use */
+  for (i = 0; i < n_pools; i++)
+    gst_object_unref (pools[i]);
+  g_free (pools);
+
+  if (ring)
+    gst_rtsp_relay_ring_free (ring);
   gst_rtsp_url_free (local_url);
 
   gst_rtsp_server_attach (server, NULL);
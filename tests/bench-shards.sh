@@ -0,0 +1,139 @@
+#!/bin/sh
+#
+# Compares relays running with and without --cpu-shards.
+#
+# Starts a local upstream with N mounts, N relays each relaying one of them
+# and M clients per relay, then samples the cpu time, context switches and
+# cpu migrations of the relays over the same window for both runs. Over that
+# window each client also counts what it receives; the throughput is averaged
+# per client and the p50/p99 buffer inter-arrival times are the worst ones
+# seen by any client.
+#
+#   bench-shards.sh [RELAYS] [CLIENTS] [SECONDS] [SHARDS]
+#
+# SHARDS defaults to one cpu per shard over all the online cpus. RELAY,
+# UPSTREAM and CLIENT can point to other binaries.
+
+RELAYS=${1:-8}
+CLIENTS=${2:-4}
+SECONDS_RUN=${3:-30}
+CPUS=$(getconf _NPROCESSORS_ONLN)
+SHARDS=${4:-$(seq -s ';' 0 $((CPUS - 1)))}
+
+# run from the tests build directory
+RELAY=${RELAY:-../src/gst-rtsp-relay}
+UPSTREAM=${UPSTREAM:-./test-upstream}
+CLIENT=${CLIENT:-./test-client}
+
+UPSTREAM_PORT=18554
+RELAY_PORT=19554
+SETTLE=5
+
+pids=""
+logs=$(mktemp -d)
+
+cleanup ()
+{
+  [ -n "$pids" ] && kill $pids 2>/dev/null
+  wait 2>/dev/null
+  pids=""
+}
+trap 'cleanup; rm -rf "$logs"' EXIT INT TERM
+
+# utime + stime in clock ticks, summed over the threads of $1
+cpu_ticks ()
+{
+  awk '{ t += $14 + $15 } END { print t + 0 }' /proc/$1/task/*/stat 2>/dev/null
+}
+
+ctx_switches ()
+{
+  awk '/ctxt_switches/ { t += $2 } END { print t + 0 }' \
+      /proc/$1/task/*/status 2>/dev/null
+}
+
+# needs CONFIG_SCHED_DEBUG, 0 otherwise
+migrations ()
+{
+  awk '/nr_migrations/ { t += $3 } END { print t + 0 }' \
+      /proc/$1/task/*/sched 2>/dev/null
+}
+
+sample ()
+{
+  ticks=0; ctx=0; mig=0
+  for pid in $relay_pids; do
+    ticks=$((ticks + $(cpu_ticks $pid)))
+    ctx=$((ctx + $(ctx_switches $pid)))
+    mig=$((mig + $(migrations $pid)))
+  done
+}
+
+run ()
+{
+  label=$1
+  shift
+
+  "$UPSTREAM" --port=$UPSTREAM_PORT --mounts=$RELAYS &
+  pids="$pids $!"
+  sleep 1
+
+  relay_pids=""
+  i=0
+  while [ $i -lt $RELAYS ]; do
+    "$RELAY" "$@" rtsp://127.0.0.1:$((RELAY_PORT + i))/cam$i \
+        rtsp://127.0.0.1:$UPSTREAM_PORT/cam$i >/dev/null &
+    relay_pids="$relay_pids $!"
+    i=$((i + 1))
+  done
+  pids="$pids $relay_pids"
+  sleep 2
+
+  rm -f "$logs"/client.*
+  client_pids=""
+  i=0
+  while [ $i -lt $RELAYS ]; do
+    c=0
+    while [ $c -lt $CLIENTS ]; do
+      "$CLIENT" --location=rtsp://127.0.0.1:$((RELAY_PORT + i))/cam$i \
+          --settle=$SETTLE --seconds=$SECONDS_RUN \
+          >"$logs/client.$i.$c" 2>/dev/null &
+      client_pids="$client_pids $!"
+      c=$((c + 1))
+    done
+    i=$((i + 1))
+  done
+  pids="$pids $client_pids"
+
+  # let the clients settle before sampling, they measure the same window
+  sleep $SETTLE
+  sample
+  ticks0=$ticks; ctx0=$ctx; mig0=$mig
+  sleep $SECONDS_RUN
+  sample
+  wait $client_pids 2>/dev/null
+
+  hz=$(getconf CLK_TCK)
+  awk -v label="$label" -v t=$((ticks - ticks0)) -v c=$((ctx - ctx0)) \
+      -v m=$((mig - mig0)) -v hz=$hz -v s=$SECONDS_RUN 'BEGIN {
+    printf "%-12s cpu %6.2f%%  ctx switches/s %8d  migrations/s %6d\n",
+        label, t * 100 / hz / s, c / s, m / s }'
+
+  # failed clients print nothing and count as having received nothing
+  cat "$logs"/client.* | awk -v n=$((RELAYS * CLIENTS)) -v s=$SECONDS_RUN '
+    { buffers += $1; bytes += $2
+      if ($3 > p50) p50 = $3
+      if ($4 > p99) p99 = $4 }
+    END {
+      printf "%-12s per client buffers/s %8.1f  kbit/s %8.1f  " \
+          "inter-arrival p50 %6.2f ms  p99 %6.2f ms  (%d/%d clients)\n",
+          "", buffers / n / s, bytes * 8 / 1000 / n / s, p50 / 1000,
+          p99 / 1000, NR, n }'
+
+  cleanup
+  sleep 1
+}
+
+echo "$RELAYS relays, $CLIENTS clients each, $SECONDS_RUN s, shards $SHARDS"
+run "unpinned"
+run "cpu-shards" --cpu-shards="$SHARDS"
@@ -0,0 +1,103 @@
+#!/bin/sh
+#
+# Runs a cluster of relays as processes on local ports in front of a local
+# origin, and checks that every mount plays from every node while the origin
+# serves each mount only once.
+#
+#   cluster.sh [NODES] [MOUNTS]
+#
+# RELAY, UPSTREAM and GST_LAUNCH can point to other binaries.
+
+NODES=${1:-3}
+MOUNTS=${2:-4}
+PLAY_SECONDS=8
+
+# run from the tests build directory
+RELAY=${RELAY:-../src/gst-rtsp-relay}
+UPSTREAM=${UPSTREAM:-./test-upstream}
+GST_LAUNCH=${GST_LAUNCH:-gst-launch-0.10}
+
+ORIGIN_PORT=18754
+NODE_PORT=19754
+
+# automake skips tests exiting with 77
+for bin in "$RELAY" "$UPSTREAM"; do
+  [ -x "$bin" ] || { echo "$bin not built, skipping"; exit 77; }
+done
+command -v "$GST_LAUNCH" >/dev/null || { echo "no $GST_LAUNCH, skipping"; exit 77; }
+
+tmpdir=$(mktemp -d)
+pids=""
+
+cleanup ()
+{
+  [ -n "$pids" ] && kill $pids 2>/dev/null
+  wait 2>/dev/null
+  rm -rf "$tmpdir"
+}
+trap cleanup EXIT INT TERM
+
+"$UPSTREAM" --port=$ORIGIN_PORT --mounts=$MOUNTS &
+pids="$pids $!"
+sleep 1
+
+nodes=""
+n=0
+while [ $n -lt $NODES ]; do
+  nodes="$nodes${nodes:+,}rtsp://127.0.0.1:$((NODE_PORT + n))"
+  n=$((n + 1))
+done
+
+# every node serves every mount
+n=0
+while [ $n -lt $NODES ]; do
+  set -- rtsp://127.0.0.1:$((NODE_PORT + n))/cam0 \
+      rtsp://127.0.0.1:$ORIGIN_PORT/cam0
+  m=1
+  while [ $m -lt $MOUNTS ]; do
+    set -- "$@" /cam$m rtsp://127.0.0.1:$ORIGIN_PORT/cam$m
+    m=$((m + 1))
+  done
+  "$RELAY" --nodes=$nodes "$@" >$tmpdir/node$n.log 2>&1 &
+  pids="$pids $!"
+  n=$((n + 1))
+done
+sleep 1
+
+n=0
+while [ $n -lt $NODES ]; do
+  m=0
+  while [ $m -lt $MOUNTS ]; do
+    "$GST_LAUNCH" -v rtspsrc location=rtsp://127.0.0.1:$((NODE_PORT + n))/cam$m \
+        latency=0 ! fakesink sync=false silent=false \
+        >$tmpdir/client$n-$m.log 2>&1 &
+    pids="$pids $!"
+    m=$((m + 1))
+  done
+  n=$((n + 1))
+done
+sleep $PLAY_SECONDS
+
+ret=0
+n=0
+while [ $n -lt $NODES ]; do
+  m=0
+  while [ $m -lt $MOUNTS ]; do
+    if ! grep -q chain $tmpdir/client$n-$m.log; then
+      echo "no buffers for /cam$m from node $n"
+      ret=1
+    fi
+    m=$((m + 1))
+  done
+  n=$((n + 1))
+done
+
+# the owners hold one session each to the origin, probes are closed by now
+sessions=$(ss -tn state established "( dport = :$ORIGIN_PORT )" | tail -n +2 | wc -l)
+echo "origin sessions: $sessions, mounts: $MOUNTS"
+if [ $sessions -ne $MOUNTS ]; then
+  cat $tmpdir/node*.log
+  ret=1
+fi
+
+exit $ret
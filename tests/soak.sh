@@ -0,0 +1,93 @@
+#!/bin/sh
+#
+# Soak test of the relay against a local upstream.
+#
+# Cycles a client connecting, playing and tearing down, and every few cycles
+# restarts the upstream so that the relay drops its media and probes and
+# reconnects on the next client. Fails if the resident memory of the relay
+# grows by more than MAX_GROWTH kB between the end of the warm up cycles
+# and the last cycle.
+#
+#   soak.sh [CYCLES] [MAX_GROWTH]
+#
+# RELAY, UPSTREAM and GST_LAUNCH can point to other binaries.
+
+CYCLES=${1:-${SOAK_CYCLES:-40}}
+MAX_GROWTH=${2:-${SOAK_MAX_GROWTH:-2048}}
+WARMUP=$((CYCLES / 4))
+PLAY_SECONDS=3
+RESTART_EVERY=5
+
+# run from the tests build directory
+RELAY=${RELAY:-../src/gst-rtsp-relay}
+UPSTREAM=${UPSTREAM:-./test-upstream}
+GST_LAUNCH=${GST_LAUNCH:-gst-launch-0.10}
+
+UPSTREAM_PORT=18654
+RELAY_PORT=19654
+
+# automake skips tests exiting with 77
+for bin in "$RELAY" "$UPSTREAM"; do
+  [ -x "$bin" ] || { echo "$bin not built, skipping"; exit 77; }
+done
+command -v "$GST_LAUNCH" >/dev/null || { echo "no $GST_LAUNCH, skipping"; exit 77; }
+
+upstream_pid=""
+relay_pid=""
+
+cleanup ()
+{
+  kill $upstream_pid $relay_pid 2>/dev/null
+  wait 2>/dev/null
+}
+trap cleanup EXIT INT TERM
+
+start_upstream ()
+{
+  "$UPSTREAM" --port=$UPSTREAM_PORT --mounts=1 &
+  upstream_pid=$!
+  sleep 1
+}
+
+rss ()
+{
+  awk '/VmRSS/ { print $2 }' /proc/$relay_pid/status
+}
+
+start_upstream
+"$RELAY" rtsp://127.0.0.1:$RELAY_PORT/cam0 \
+    rtsp://127.0.0.1:$UPSTREAM_PORT/cam0 >/dev/null &
+relay_pid=$!
+sleep 1
+
+baseline=""
+cycle=1
+while [ $cycle -le $CYCLES ]; do
+  if [ $((cycle % RESTART_EVERY)) -eq 0 ]; then
+    kill $upstream_pid
+    wait $upstream_pid 2>/dev/null
+    start_upstream
+  fi
+
+  "$GST_LAUNCH" -q rtspsrc location=rtsp://127.0.0.1:$RELAY_PORT/cam0 \
+      latency=0 ! fakesink sync=false >/dev/null 2>&1 &
+  client_pid=$!
+  sleep $PLAY_SECONDS
+  # gst-launch tears the session down on SIGINT
+  kill -INT $client_pid
+  wait $client_pid 2>/dev/null
+
+  if ! kill -0 $relay_pid 2>/dev/null; then
+    echo "relay died in cycle $cycle"
+    exit 1
+  fi
+
+  [ $cycle -eq $WARMUP ] && baseline=$(rss)
+  echo "cycle $cycle rss $(rss) kB"
+  cycle=$((cycle + 1))
+done
+
+last=$(rss)
+growth=$((last - ${baseline:-$last}))
+echo "rss grew by $growth kB after warm up, allowed $MAX_GROWTH kB"
+[ $growth -le $MAX_GROWTH ]
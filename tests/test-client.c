@@ -0,0 +1,192 @@
+/*
+ * This program is free software. It comes without any warranty, to
+ * the extent permitted by applicable law. You can redistribute it
+ * and/or modify it under the terms of the Do What The Fuck You Want
+ * To Public License, Version 2, as published by Sam Hocevar. See
+ * http://sam.zoy.org/wtfpl/COPYING for more details.
+ *
+ * Author: Alessandro Decina <alessandro.d@gmail.com>
+ */
+
+/* an rtsp client for the relay benchmarks: plays LOCATION and, over a window
+ * of SECONDS starting after SETTLE seconds, counts the buffers and bytes
+ * received and the gaps between them. Prints
+ *
+ *   BUFFERS BYTES P50_US P99_US
+ *
+ * on exit, the percentiles being those of the buffer inter-arrival times.
+ * Prints nothing if playback fails. */
+
+#include <gst/gst.h>
+
+static gchar *location = NULL;
+static gint settle = 5;
+static gint seconds = 30;
+
+static GOptionEntry entries[] = {
+  { "location", 0, 0, G_OPTION_ARG_STRING, &location,
+    "rtsp url to play", "URL" },
+  { "settle", 0, 0, G_OPTION_ARG_INT, &settle,
+    "Seconds to wait before measuring", "SECONDS" },
+  { "seconds", 0, 0, G_OPTION_ARG_INT, &seconds,
+    "Length of the measuring window", "SECONDS" },
+  { NULL }
+};
+
+static volatile gint measuring = 0;
+static GstClockTime last_arrival = GST_CLOCK_TIME_NONE;
+static guint64 buffers = 0;
+static guint64 bytes = 0;
+static GArray *gaps = NULL;
+static gint exit_code = 0;
+
+/* runs in the only streaming thread of fakesink */
+static gboolean
+buffer_probe (GstPad *pad, GstBuffer *buffer, gpointer user_data)
+{
+  GstClockTime now;
+  guint64 gap;
+
+  if (!g_atomic_int_get (&measuring))
+    return TRUE;
+
+  now = gst_util_get_timestamp ();
+  if (GST_CLOCK_TIME_IS_VALID (last_arrival)) {
+    gap = GST_TIME_AS_USECONDS (now - last_arrival);
+    g_array_append_val (gaps, gap);
+  }
+  last_arrival = now;
+
+  buffers += 1;
+  bytes += GST_BUFFER_SIZE (buffer);
+
+  return TRUE;
+}
+
+static gboolean
+start_measuring (gpointer user_data)
+{
+  g_atomic_int_set (&measuring, 1);
+
+  return FALSE;
+}
+
+static gboolean
+stop_measuring (GMainLoop *loop)
+{
+  g_atomic_int_set (&measuring, 0);
+  g_main_loop_quit (loop);
+
+  return FALSE;
+}
+
+static gboolean
+bus_call (GstBus *bus, GstMessage *message, GMainLoop *loop)
+{
+  GError *error = NULL;
+
+  if (GST_MESSAGE_TYPE (message) == GST_MESSAGE_ERROR) {
+    gst_message_parse_error (message, &error, NULL);
+    g_printerr ("%s: %s\n", location, error->message);
+    g_error_free (error);
+
+    exit_code = 1;
+    g_main_loop_quit (loop);
+  } else if (GST_MESSAGE_TYPE (message) == GST_MESSAGE_EOS) {
+    g_main_loop_quit (loop);
+  }
+
+  return TRUE;
+}
+
+static gint
+compare_gaps (gconstpointer a, gconstpointer b)
+{
+  guint64 ga = *(const guint64 *) a;
+  guint64 gb = *(const guint64 *) b;
+
+  return ga < gb ? -1 : (ga > gb ? 1 : 0);
+}
+
+static guint64
+percentile (guint p)
+{
+  if (gaps->len == 0)
+    return 0;
+
+  return g_array_index (gaps, guint64, (gaps->len - 1) * p / 100);
+}
+
+int
+main (int argc, char **argv)
+{
+  GMainLoop *loop;
+  GstElement *pipeline, *sink;
+  GstBus *bus;
+  GstPad *pad;
+  GOptionContext *context;
+  GError *error = NULL;
+  gchar *launch;
+
+  context = g_option_context_new (NULL);
+  g_option_context_add_main_entries (context, entries, NULL);
+  g_option_context_add_group (context, gst_init_get_option_group ());
+  if (!g_option_context_parse (context, &argc, &argv, &error)) {
+    g_printerr ("%s\n", error->message);
+    g_error_free (error);
+
+    return 1;
+  }
+  g_option_context_free (context);
+
+  if (location == NULL) {
+    g_printerr ("--location is required\n");
+
+    return 1;
+  }
+
+  launch = g_strdup_printf ("rtspsrc location=%s latency=0 ! "
+      "fakesink name=sink sync=false", location);
+  pipeline = gst_parse_launch (launch, &error);
+  g_free (launch);
+  if (error != NULL) {
+    g_printerr ("%s\n", error->message);
+    g_error_free (error);
+
+    return 1;
+  }
+
+  gaps = g_array_new (FALSE, FALSE, sizeof (guint64));
+  loop = g_main_loop_new (NULL, FALSE);
+
+  sink = gst_bin_get_by_name (GST_BIN (pipeline), "sink");
+  pad = gst_element_get_static_pad (sink, "sink");
+  gst_pad_add_buffer_probe (pad, G_CALLBACK (buffer_probe), NULL);
+  gst_object_unref (pad);
+  gst_object_unref (sink);
+
+  bus = gst_pipeline_get_bus (GST_PIPELINE (pipeline));
+  gst_bus_add_watch (bus, (GstBusFunc) bus_call, loop);
+  gst_object_unref (bus);
+
+  g_timeout_add_seconds (settle, start_measuring, NULL);
+  g_timeout_add_seconds (settle + seconds, (GSourceFunc) stop_measuring, loop);
+
+  gst_element_set_state (pipeline, GST_STATE_PLAYING);
+  g_main_loop_run (loop);
+  /* joins the streaming thread, the counters are stable after this */
+  gst_element_set_state (pipeline, GST_STATE_NULL);
+  gst_object_unref (pipeline);
+
+  /* a failed client prints nothing so that it doesn't skew the averages */
+  if (exit_code == 0) {
+    g_array_sort (gaps, compare_gaps);
+    g_print ("%" G_GUINT64_FORMAT " %" G_GUINT64_FORMAT " %" G_GUINT64_FORMAT
+        " %" G_GUINT64_FORMAT "\n", buffers, bytes, percentile (50),
+        percentile (99));
+  }
+
+  g_array_free (gaps, TRUE);
+
+  return exit_code;
+}
@@ -0,0 +1,101 @@
+/*
+ * This program is free software. It comes without any warranty, to
+ * the extent permitted by applicable law. You can redistribute it
+ * and/or modify it under the terms of the Do What The Fuck You Want
+ * To Public License, Version 2, as published by Sam Hocevar. See
+ * http://sam.zoy.org/wtfpl/COPYING for more details.
+ *
+ * Author: Alessandro Decina <alessandro.d@gmail.com>
+ */
+
+/* a local camera-like upstream for the relay tests: serves live H.264 test
+ * streams on rtsp://127.0.0.1:PORT/cam0 ... /camN-1 */
+
+#include <gst/gst.h>
+#include <gst/rtsp-server/rtsp-server.h>
+
+static gint port = 8554;
+static gint mounts = 1;
+static gint bitrate = 1024;
+
+static GOptionEntry entries[] = {
+  { "port", 0, 0, G_OPTION_ARG_INT, &port,
+    "Port to listen on", "PORT" },
+  { "mounts", 0, 0, G_OPTION_ARG_INT, &mounts,
+    "Number of mounts, served as /cam0 ... /camN-1", "N" },
+  { "bitrate", 0, 0, G_OPTION_ARG_INT, &bitrate,
+    "Bitrate of each stream in kbit/s", "KBITRATE" },
+  { NULL }
+};
+
+static gboolean
+timeout (GstRTSPServer *server, gboolean ignored)
+{
+  GstRTSPSessionPool *pool;
+
+  pool = gst_rtsp_server_get_session_pool (server);
+  gst_rtsp_session_pool_cleanup (pool);
+  g_object_unref (pool);
+
+  return TRUE;
+}
+
+int
+main (int argc, char **argv)
+{
+  GMainLoop *loop;
+  GstRTSPServer *server;
+  GstRTSPMediaMapping *mapping;
+  GstRTSPMediaFactory *factory;
+  GOptionContext *context;
+  GError *error = NULL;
+  gchar *service, *launch, *path;
+  gint i;
+
+  context = g_option_context_new (NULL);
+  g_option_context_add_main_entries (context, entries, NULL);
+  g_option_context_add_group (context, gst_init_get_option_group ());
+  if (!g_option_context_parse (context, &argc, &argv, &error)) {
+    g_printerr ("%s\n", error->message);
+    g_error_free (error);
+
+    return 1;
+  }
+  g_option_context_free (context);
+
+  loop = g_main_loop_new (NULL, FALSE);
+
+  server = gst_rtsp_server_new ();
+  service = g_strdup_printf ("%d", port);
+  gst_rtsp_server_set_service (server, service);
+  g_free (service);
+
+  mapping = gst_rtsp_server_get_media_mapping (server);
+  for (i = 0; i < mounts; i++) {
+    /* different patterns so that the mounts don't share SPS/PPS */
+    launch = g_strdup_printf ("( videotestsrc is-live=true pattern=%d ! "
+        "video/x-raw-yuv,width=640,height=480,framerate=25/1 ! "
+        "x264enc tune=zerolatency bitrate=%d key-int-max=50 ! "
+        "rtph264pay name=pay0 pt=96 )", i % 20, bitrate);
+    factory = gst_rtsp_media_factory_new ();
+    gst_rtsp_media_factory_set_launch (factory, launch);
+    gst_rtsp_media_factory_set_shared (factory, TRUE);
+    g_free (launch);
+
+    path = g_strdup_printf ("/cam%d", i);
+    gst_rtsp_media_mapping_add_factory (mapping, path, factory);
+    g_free (path);
+  }
+  g_object_unref (mapping);
+
+  if (gst_rtsp_server_attach (server, NULL) == 0) {
+    g_printerr ("couldn't listen on port %d\n", port);
+
+    return 1;
+  }
+
+  g_timeout_add_seconds (2, (GSourceFunc) timeout, server);
+  g_main_loop_run (loop);
+
+  return 0;
+}